@@ -1,4 +1,4 @@
-QT       += core gui concurrent
+QT       += core gui concurrent network
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -9,15 +9,43 @@ CONFIG += c++17
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    animation_renderer.cpp \
+    buddhabrot.cpp \
     draw_worker.cpp \
     drawspace.cpp \
+    export_job.cpp \
+    fractal.cpp \
+    frame_channel.cpp \
     main.cpp \
-    mainwindow.cpp
+    mainwindow.cpp \
+    npy_writer.cpp \
+    poster_renderer.cpp \
+    render_pool.cpp \
+    tile_cache.cpp \
+    tile_coordinator.cpp \
+    tile_protocol.cpp \
+    tile_pyramid.cpp \
+    tile_server.cpp \
+    tile_worker.cpp
 
 HEADERS += \
+    animation_renderer.h \
+    buddhabrot.h \
     draw_worker.h \
     drawspace.h \
-    mainwindow.h
+    export_job.h \
+    fractal.h \
+    frame_channel.h \
+    mainwindow.h \
+    npy_writer.h \
+    poster_renderer.h \
+    render_pool.h \
+    tile_cache.h \
+    tile_coordinator.h \
+    tile_protocol.h \
+    tile_pyramid.h \
+    tile_server.h \
+    tile_worker.h
 
 FORMS += \
     mainwindow.ui
@@ -0,0 +1,453 @@
+#include "animation_renderer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <QImage>
+#include <QTextStream>
+#include <QThread>
+
+class Animation_renderer::Frame_writer : public QThread
+{
+public:
+    explicit Frame_writer(Animation_renderer* owner)
+        : owner(owner)
+    {}
+
+    virtual void run() override
+    {
+        owner->write_loop();
+    }
+private:
+    Animation_renderer* owner;
+};
+
+Animation_renderer::Animation_renderer(settings cfg)
+    : cfg(cfg)
+    , frame_count(0)
+    , to_y4m(false)
+    , free_frames(FRAME_BUFFERS)
+    , filled_frames(0)
+    , write_failed(false)
+    , produced_frames(0)
+    , reused(0)
+{
+    if (this->cfg.frames_per_segment < 1)
+        this->cfg.frames_per_segment = 1;
+    if (this->cfg.fps < 1)
+        this->cfg.fps = 1;
+}
+
+Animation_renderer::~Animation_renderer()
+{}
+
+QString Animation_renderer::error_string() const
+{
+    return error;
+}
+
+int Animation_renderer::reused_frames() const
+{
+    return reused;
+}
+
+// One keyframe per line: "center_x center_y zoom iterations", '#' starts a comment
+bool Animation_renderer::load_keyframes(const QString& path, QVector<keyframe>& keyframes, QString& error)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        error = file.errorString();
+        return false;
+    }
+
+    QTextStream in(&file);
+    int line_num = 0;
+    while (!in.atEnd())
+    {
+        QString line = in.readLine().simplified();
+        line_num++;
+        if (line.isEmpty() || line.startsWith("#"))
+            continue;
+
+        QStringList parts = line.split(' ');
+        bool ok[4] = {false, false, false, false};
+        if (parts.size() == 4)
+        {
+            keyframe frame{QPointF(parts[0].toDouble(&ok[0]), parts[1].toDouble(&ok[1])),
+                           parts[2].toDouble(&ok[2]), parts[3].toInt(&ok[3])};
+            if (ok[0] && ok[1] && ok[2] && ok[3] && frame.zoom > 0 && frame.max_iter_num > 0)
+            {
+                keyframes.append(frame);
+                continue;
+            }
+        }
+        error = QString("Bad keyframe at line %1").arg(line_num);
+        return false;
+    }
+
+    if (keyframes.isEmpty())
+    {
+        error = "No keyframes";
+        return false;
+    }
+    return true;
+}
+
+// Zoom is interpolated geometrically, the center and the iteration cap linearly
+frame_params Animation_renderer::frame_at(int index) const
+{
+    frame_params params = cfg.params;
+    const int last = static_cast<int>(cfg.keyframes.size()) - 1;
+    const int segment = std::min(index / cfg.frames_per_segment, last);
+    const keyframe& from = cfg.keyframes[segment];
+    if (segment == last)
+    {
+        params.frame_center = from.frame_center;
+        params.zoom = from.zoom;
+        params.max_iter_num = from.max_iter_num;
+        return params;
+    }
+
+    const keyframe& to = cfg.keyframes[segment + 1];
+    const double t = static_cast<double>(index - segment * cfg.frames_per_segment) / cfg.frames_per_segment;
+    params.frame_center = from.frame_center + (to.frame_center - from.frame_center) * t;
+    params.zoom = from.zoom * std::pow(to.zoom / from.zoom, t);
+    params.max_iter_num = static_cast<int>(std::lround(from.max_iter_num + (to.max_iter_num - from.max_iter_num) * t));
+    return params;
+}
+
+// A frame can take over the previous one's iterations if it shows the same
+// picture moved by a whole number of pixels
+bool Animation_renderer::find_shift(const frame_params& prev, const frame_params& next, int& shift_x, int& shift_y) const
+{
+    if (prev.zoom != next.zoom || prev.max_iter_num != next.max_iter_num)
+        return false;
+
+    const double dx = (next.frame_center.x() - prev.frame_center.x()) / next.zoom;
+    const double dy = (next.frame_center.y() - prev.frame_center.y()) / next.zoom;
+    if (std::abs(dx) >= next.w || std::abs(dy) >= next.h)
+        return false;
+    if (std::abs(dx - std::round(dx)) > REUSE_EPS || std::abs(dy - std::round(dy)) > REUSE_EPS)
+        return false;
+
+    shift_x = static_cast<int>(std::round(dx));
+    shift_y = static_cast<int>(std::round(dy));
+    return true;
+}
+
+// Otherwise a small zoom step still lets an earlier frame point at the blocks
+// that are probably inside the set. Frames are counted FRAMES_IN_FLIGHT at a time,
+// so the newest one known to be complete is SEED_LAG frames back. The border check
+// in render_seeded assumes the set has no holes, which holds for polynomials but
+// not for the burning ship.
+bool Animation_renderer::can_seed(const frame_params& prev, const frame_params& next) const
+{
+    if (next.formula == formula_kind::BURNING_SHIP)
+        return false;
+
+    const double step = next.zoom / prev.zoom;
+    if (step > SEED_MAX_STEP || step < 1 / SEED_MAX_STEP)
+        return false;
+    const double dx = (next.frame_center.x() - prev.frame_center.x()) / prev.zoom;
+    const double dy = (next.frame_center.y() - prev.frame_center.y()) / prev.zoom;
+    return std::abs(dx) < next.w && std::abs(dy) < next.h;
+}
+
+// Frames are submitted to the render pool FRAMES_IN_FLIGHT at a time, so the
+// threads move on to the next frame while the tail of the previous one is still
+// being computed. A writer thread colours and encodes finished frames in order.
+bool Animation_renderer::render()
+{
+    const int w = cfg.params.w, h = cfg.params.h;
+    if (w < 1 || h < 1 || cfg.keyframes.isEmpty())
+    {
+        error = "Empty animation";
+        return false;
+    }
+    frame_count = static_cast<int>(cfg.keyframes.size() - 1) * cfg.frames_per_segment + 1;
+
+    to_y4m = (cfg.path == "-" || cfg.path.endsWith(".y4m"));
+    if (to_y4m)
+    {
+        if (cfg.path != "-")
+            out.setFileName(cfg.path);
+        bool opened = (cfg.path == "-") ? out.open(stdout, QIODevice::WriteOnly)
+                                        : out.open(QIODevice::WriteOnly | QIODevice::Truncate);
+        QByteArray header = QString("YUV4MPEG2 W%1 H%2 F%3:1 Ip A1:1 C444\n").arg(w).arg(h).arg(cfg.fps).toLatin1();
+        if (!opened || out.write(header) != header.size())
+        {
+            error = out.errorString();
+            return false;
+        }
+    }
+    else if (!cfg.path.contains("%1"))
+    {
+        error = "Output must be '-', a .y4m file or an image name pattern with %1";
+        return false;
+    }
+
+    frames.resize(FRAME_BUFFERS);
+    for (frame_buffer& frame : frames)
+        frame.iters.resize(w * h);
+
+    if (!cfg.workers.isEmpty())
+        coordinator.reset(new Tile_coordinator(cfg.workers));
+
+    Frame_writer writer(this);
+    writer.start();
+
+    Render_pool& pool = Render_pool::instance();
+    QVector<int> in_flight;
+    for (int j = 0; j < frame_count && !write_failed; j++)
+    {
+        free_frames.acquire();
+        frame_buffer& frame = frames[j % FRAME_BUFFERS];
+        frame.index = j;
+        frame.params = frame_at(j);
+        frame.counter = fractal::select_kernel(frame.params);
+        frame.reuse = j > 0 && find_shift(frames[(j - 1) % FRAME_BUFFERS].params, frame.params,
+                                          frame.shift_x, frame.shift_y);
+        frame.seeded = cfg.seed && j >= SEED_LAG && !frame.reuse && !coordinator
+                       && can_seed(frames[(j - SEED_LAG) % FRAME_BUFFERS].params, frame.params);
+
+        // Frames that can't reuse their predecessor are split into tiles for the
+        // workers; the copied frames only need narrow strips, those stay local
+        if (coordinator && !frame.reuse)
+        {
+            if (!coordinator->render(frame.params, 0, h, frame.iters.data()))
+            {
+                error = coordinator->error_string();
+                write_failed = true;
+                break;
+            }
+            while (!in_flight.isEmpty())
+            {
+                finish_frame(frames[in_flight.front() % FRAME_BUFFERS]);
+                in_flight.pop_front();
+            }
+            finish_frame(frame);
+            continue;
+        }
+
+        // At most FRAMES_IN_FLIGHT - 1 frames are still being counted here, so
+        // the one a seeded frame reads is already complete. Its tasks take whole
+        // rows of blocks
+        int task_count = std::min(h, pool.thread_count() * TASKS_PER_THREAD);
+        int rows_per_task = (h + task_count - 1) / task_count;
+        if (frame.seeded)
+        {
+            rows_per_task = (rows_per_task + SEED_BLOCK - 1) / SEED_BLOCK * SEED_BLOCK;
+            task_count = (h + rows_per_task - 1) / rows_per_task;
+        }
+        frame.batch = pool.submit(task_count, [this, &frame, rows_per_task, h](int i)
+                                  {
+                                      int from_h = i * rows_per_task;
+                                      render_rows(frame, from_h, std::min(from_h + rows_per_task, h));
+                                  }, cfg.priority);
+        in_flight.append(j);
+
+        if (in_flight.size() == FRAMES_IN_FLIGHT)
+        {
+            finish_frame(frames[in_flight.front() % FRAME_BUFFERS]);
+            in_flight.pop_front();
+        }
+    }
+    while (!in_flight.isEmpty())
+    {
+        finish_frame(frames[in_flight.front() % FRAME_BUFFERS]);
+        in_flight.pop_front();
+    }
+    // One extra token tells the writer that no more frames will come
+    filled_frames.release();
+    writer.wait();
+
+    if (to_y4m)
+    {
+        if (!write_failed && !out.flush())
+            write_failed = true;
+        if (write_failed && error.isEmpty())
+            error = out.errorString();
+        out.close();
+    }
+    else if (write_failed && error.isEmpty())
+        error = "Can't save a frame";
+    return !write_failed;
+}
+
+// With a reused frame only the strips uncovered by the shift are computed here,
+// the rest is copied in finish_frame once the previous frame is complete
+void Animation_renderer::render_rows(frame_buffer& frame, int from_h, int to_h)
+{
+    if (frame.seeded)
+    {
+        render_seeded(frame, from_h, to_h);
+        return;
+    }
+
+    const int w = frame.params.w, h = frame.params.h;
+    const int cover_from = frame.reuse ? std::max(0, -frame.shift_x) : 0;
+    const int cover_to = frame.reuse ? std::min(w, w - frame.shift_x) : 0;
+    for (int y = from_h; y < to_h; y++)
+    {
+        int* iter_line = frame.iters.data() + y * w;
+        const int prev_y = y + frame.shift_y;
+        if (!frame.reuse || prev_y < 0 || prev_y >= h)
+        {
+            fractal::count_row(frame.counter, frame.params, y, 0, w, iter_line);
+            continue;
+        }
+        fractal::count_row(frame.counter, frame.params, y, 0, cover_from, iter_line);
+        fractal::count_row(frame.counter, frame.params, y, cover_to, w, iter_line);
+    }
+}
+
+// Blocks the earlier frame saw inside the set only get their border counted, and
+// if no border pixel escapes within the cap, the inside is filled with the cap
+// without iterating, as in the Mariani-Silver algorithm. This is an approximation:
+// the set has no holes, but the border is only sampled once per pixel, so a thin
+// escaping filament that crosses the block between two border samples is filled
+// as well. --no-seed turns it off for exact output.
+void Animation_renderer::render_seeded(frame_buffer& frame, int from_h, int to_h)
+{
+    const frame_params& params = frame.params;
+    const frame_buffer& prev = frames[(frame.index - SEED_LAG) % FRAME_BUFFERS];
+    const fractal::kernel& counter = frame.counter;
+    const int w = params.w, cap = params.max_iter_num;
+    int* iters = frame.iters.data();
+    for (int from_y = from_h; from_y < to_h; from_y += SEED_BLOCK)
+    {
+        const int to_y = std::min(from_y + SEED_BLOCK, to_h);
+        for (int from_x = 0; from_x < w; from_x += SEED_BLOCK)
+        {
+            const int to_x = std::min(from_x + SEED_BLOCK, w);
+            if (!was_interior(prev, params, from_x, from_y, to_x, to_y))
+            {
+                for (int y = from_y; y < to_y; y++)
+                    counter.row(params, y, from_x, to_x, 1, iters + y * w + from_x);
+                continue;
+            }
+
+            counter.row(params, from_y, from_x, to_x, 1, iters + from_y * w + from_x);
+            counter.row(params, to_y - 1, from_x, to_x, 1, iters + (to_y - 1) * w + from_x);
+            for (int y = from_y + 1; y < to_y - 1; y++)
+            {
+                iters[y * w + from_x] = counter.point(params, from_x, y);
+                iters[y * w + to_x - 1] = counter.point(params, to_x - 1, y);
+            }
+
+            bool inside = true;
+            for (int x = from_x; x < to_x && inside; x++)
+                inside = iters[from_y * w + x] >= cap && iters[(to_y - 1) * w + x] >= cap;
+            for (int y = from_y + 1; y < to_y - 1 && inside; y++)
+                inside = iters[y * w + from_x] >= cap && iters[y * w + to_x - 1] >= cap;
+            for (int y = from_y + 1; y < to_y - 1; y++)
+            {
+                if (inside)
+                    std::fill(iters + y * w + from_x + 1, iters + y * w + to_x - 1, cap);
+                else
+                    counter.row(params, y, from_x + 1, to_x - 1, 1, iters + y * w + from_x + 1);
+            }
+        }
+    }
+}
+
+// Whether the earlier frame only saw points that don't escape around the place
+// the block of the next frame covers, with a pixel of margin on every side
+bool Animation_renderer::was_interior(const frame_buffer& prev, const frame_params& next,
+                                      int from_x, int from_y, int to_x, int to_y) const
+{
+    const frame_params& old = prev.params;
+    const int w = old.w, h = old.h;
+    const double scale = next.zoom / old.zoom;
+    const double shift_x = w / 2.0 + (next.frame_center.x() - old.frame_center.x()) / old.zoom;
+    const double shift_y = h / 2.0 + (next.frame_center.y() - old.frame_center.y()) / old.zoom;
+    const int old_from_x = static_cast<int>(std::floor((from_x - w / 2.0) * scale + shift_x)) - 1;
+    const int old_to_x = static_cast<int>(std::ceil((to_x - 1 - w / 2.0) * scale + shift_x)) + 1;
+    const int old_from_y = static_cast<int>(std::floor((from_y - h / 2.0) * scale + shift_y)) - 1;
+    const int old_to_y = static_cast<int>(std::ceil((to_y - 1 - h / 2.0) * scale + shift_y)) + 1;
+    if (old_from_x < 0 || old_from_y < 0 || old_to_x >= w || old_to_y >= h)
+        return false;
+
+    for (int y = old_from_y; y <= old_to_y; y++)
+    {
+        const int* iter_line = prev.iters.constData() + y * w;
+        for (int x = old_from_x; x <= old_to_x; x++)
+        {
+            if (iter_line[x] < old.max_iter_num)
+                return false;
+        }
+    }
+    return true;
+}
+
+void Animation_renderer::finish_frame(frame_buffer& frame)
+{
+    if (frame.batch)
+        frame.batch->wait();
+    frame.batch.reset();
+
+    if (frame.reuse)
+    {
+        const frame_buffer& prev = frames[(frame.index - 1) % FRAME_BUFFERS];
+        const int w = frame.params.w, h = frame.params.h;
+        const int cover_from = std::max(0, -frame.shift_x);
+        const int cover_to = std::min(w, w - frame.shift_x);
+        for (int y = std::max(0, -frame.shift_y); y < std::min(h, h - frame.shift_y); y++)
+        {
+            std::memcpy(frame.iters.data() + y * w + cover_from,
+                        prev.iters.constData() + (y + frame.shift_y) * w + cover_from + frame.shift_x,
+                        (cover_to - cover_from) * sizeof(int));
+        }
+        reused++;
+    }
+    else if (frame.seeded)
+        reused++;
+
+    produced_frames++;
+    filled_frames.release();
+}
+
+void Animation_renderer::write_loop()
+{
+    QVector<unsigned char> rgb(cfg.params.w * cfg.params.h * 3);
+    QByteArray yuv;
+    for (int j = 0;; j++)
+    {
+        filled_frames.acquire();
+        if (j == produced_frames)
+            return;
+
+        if (!write_failed && !write_frame(frames[j % FRAME_BUFFERS], rgb, yuv))
+            write_failed = true;
+        free_frames.release();
+    }
+}
+
+bool Animation_renderer::write_frame(const frame_buffer& frame, QVector<unsigned char>& rgb, QByteArray& yuv)
+{
+    const int w = frame.params.w, h = frame.params.h;
+    for (int y = 0; y < h; y++)
+        fractal::colour_row(frame.params, frame.iters.constData() + y * w, rgb.data() + y * w * 3);
+
+    if (!to_y4m)
+    {
+        QImage image(rgb.constData(), w, h, w * 3, QImage::Format_RGB888);
+        return image.save(cfg.path.arg(frame.index, 6, 10, QChar('0')));
+    }
+
+    // BT.601 studio range, planar 4:4:4
+    const int plane = w * h;
+    yuv.resize(plane * 3);
+    unsigned char* y_plane = reinterpret_cast<unsigned char*>(yuv.data());
+    unsigned char* u_plane = y_plane + plane;
+    unsigned char* v_plane = u_plane + plane;
+    for (int i = 0; i < plane; i++)
+    {
+        const int r = rgb[i * 3], g = rgb[i * 3 + 1], b = rgb[i * 3 + 2];
+        y_plane[i] = static_cast<unsigned char>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+        u_plane[i] = static_cast<unsigned char>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+        v_plane[i] = static_cast<unsigned char>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+    }
+    return out.write("FRAME\n", 6) == 6 && out.write(yuv) == yuv.size();
+}
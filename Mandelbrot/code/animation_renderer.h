@@ -0,0 +1,92 @@
+#ifndef ANIMATION_RENDERER_H
+#define ANIMATION_RENDERER_H
+
+#include <atomic>
+#include <memory>
+#include <QFile>
+#include <QSemaphore>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include "fractal.h"
+#include "render_pool.h"
+#include "tile_coordinator.h"
+
+class Animation_renderer
+{
+    class Frame_writer;
+public:
+    struct keyframe
+    {
+        QPointF frame_center;
+        double zoom;
+        int max_iter_num;
+    };
+
+    struct settings
+    {
+        frame_params params;
+        QVector<keyframe> keyframes;
+        int frames_per_segment;
+        int fps;
+        QString path;
+        QStringList workers;
+        bool seed = true;
+        Render_pool::priority priority = Render_pool::priority::INTERACTIVE;
+    };
+
+    explicit Animation_renderer(settings cfg);
+    ~Animation_renderer();
+
+    static bool load_keyframes(const QString& path, QVector<keyframe>& keyframes, QString& error);
+
+    bool render();
+    QString error_string() const;
+    int reused_frames() const;
+private:
+    struct frame_buffer
+    {
+        int index;
+        frame_params params;
+        fractal::kernel counter;
+        QVector<int> iters;
+        std::shared_ptr<Render_batch> batch;
+        bool reuse;
+        int shift_x, shift_y;
+        bool seeded;
+    };
+
+    constexpr static int FRAMES_IN_FLIGHT = 3;
+    // A seeded frame reads the frame FRAMES_IN_FLIGHT back while it is counted,
+    // so that one's buffer can't be handed to a new frame until it is done
+    constexpr static int FRAME_BUFFERS = 2 * FRAMES_IN_FLIGHT;
+    constexpr static int TASKS_PER_THREAD = 4;
+    constexpr static double REUSE_EPS = 1e-6;
+    constexpr static int SEED_BLOCK = 16;
+    constexpr static int SEED_LAG = FRAMES_IN_FLIGHT;
+    constexpr static double SEED_MAX_STEP = 1.5;
+    settings cfg;
+    int frame_count;
+    bool to_y4m;
+    QFile out;
+    QString error;
+    QVector<frame_buffer> frames;
+    QSemaphore free_frames;
+    QSemaphore filled_frames;
+    std::atomic_bool write_failed;
+    std::atomic_int produced_frames;
+    int reused;
+    std::unique_ptr<Tile_coordinator> coordinator;
+
+    frame_params frame_at(int index) const;
+    bool find_shift(const frame_params& prev, const frame_params& next, int& shift_x, int& shift_y) const;
+    bool can_seed(const frame_params& prev, const frame_params& next) const;
+    void render_rows(frame_buffer& frame, int from_h, int to_h);
+    void render_seeded(frame_buffer& frame, int from_h, int to_h);
+    bool was_interior(const frame_buffer& prev, const frame_params& next, int from_x, int from_y, int to_x, int to_y) const;
+    void finish_frame(frame_buffer& frame);
+    void write_loop();
+    bool write_frame(const frame_buffer& frame, QVector<unsigned char>& rgb, QByteArray& yuv);
+};
+
+#endif // ANIMATION_RENDERER_H
@@ -0,0 +1,141 @@
+#include "buddhabrot.h"
+#include <algorithm>
+#include <cmath>
+
+Buddhabrot::Buddhabrot(const frame_params& params, int slot_count)
+    : params(params)
+    , map_params(params)
+    , corner_iters((GRID_SIZE + 1) * (GRID_SIZE + 1))
+    , histograms(slot_count, QVector<quint32>(params.w * params.h))
+    , traces(slot_count, QVector<double>(2 * params.max_iter_num))
+    , density(params.w * params.h)
+    , samples(0)
+{
+    // Orbits always start at zero, whatever the window shows
+    map_params.w = GRID_SIZE;
+    map_params.h = GRID_SIZE;
+    map_params.zoom = 2 * PLANE_RADIUS / GRID_SIZE;
+    map_params.frame_center = QPointF(0, 0);
+    map_params.julia = false;
+    counter = fractal::select_kernel(map_params);
+
+    for (int i = 0; i < slot_count; i++)
+        generators.append(std::mt19937_64(i + 1));
+}
+
+int Buddhabrot::slot_count() const
+{
+    return histograms.size();
+}
+
+long long Buddhabrot::sample_count() const
+{
+    return samples;
+}
+
+// Corner y of the map grid, there are GRID_SIZE + 1 of them
+void Buddhabrot::count_map_row(int y)
+{
+    fractal::count_span(counter, map_params, y, 0, GRID_SIZE + 1, corner_iters.data() + y * (GRID_SIZE + 1));
+}
+
+void Buddhabrot::build_map()
+{
+    const int max_iter_num = params.max_iter_num;
+    qint64 total = 0;
+    for (int y = 0; y < GRID_SIZE; y++)
+    {
+        for (int x = 0; x < GRID_SIZE; x++)
+        {
+            const int* top = corner_iters.constData() + y * (GRID_SIZE + 1) + x;
+            const int* bottom = top + GRID_SIZE + 1;
+            const int bounded = (top[0] >= max_iter_num) + (top[1] >= max_iter_num)
+                              + (bottom[0] >= max_iter_num) + (bottom[1] >= max_iter_num);
+            if (bounded == 4)
+                continue;
+
+            const int weight = bounded > 0 ? EDGE_WEIGHT : 1;
+            total += weight;
+            cells.append(y * GRID_SIZE + x);
+            cell_hits.append(EDGE_WEIGHT / weight);
+            cell_bounds.append(total);
+        }
+    }
+}
+
+void Buddhabrot::sample(int slot)
+{
+    if (cell_bounds.isEmpty())
+        return;
+
+    std::mt19937_64& generator = generators[slot];
+    std::uniform_int_distribution<qint64> pick(0, cell_bounds.back() - 1);
+    std::uniform_real_distribution<double> offset(0.0, 1.0);
+    quint32* histogram = histograms[slot].data();
+    double* trace = traces[slot].data();
+
+    const int w = params.w, h = params.h;
+    const int max_iter_num = params.max_iter_num;
+    const double cell_size = 2 * PLANE_RADIUS / GRID_SIZE;
+    const double scale = 1 / params.zoom;
+    const double left = params.frame_center.x() - (w / 2.0 + 0.5) * params.zoom;
+    const double top = params.frame_center.y() - (h / 2.0 + 0.5) * params.zoom;
+
+    for (int i = 0; i < SAMPLES_PER_ROUND; i++)
+    {
+        const int k = std::upper_bound(cell_bounds.constBegin(), cell_bounds.constEnd(), pick(generator)) - cell_bounds.constBegin();
+        const int cell = cells[k];
+        const quint32 hits = cell_hits[k];
+        const double c_re = (cell % GRID_SIZE + offset(generator)) * cell_size - PLANE_RADIUS;
+        const double c_im = (cell / GRID_SIZE + offset(generator)) * cell_size - PLANE_RADIUS;
+
+        const int length = counter.orbit(c_re, c_im, max_iter_num, trace);
+        for (int j = 0; j < length; j++)
+        {
+            const double x = (trace[2 * j] - left) * scale;
+            const double y = (trace[2 * j + 1] - top) * scale;
+            if (x >= 0 && x < w && y >= 0 && y < h)
+                histogram[static_cast<int>(y) * w + static_cast<int>(x)] += hits;
+        }
+    }
+}
+
+void Buddhabrot::finish_round()
+{
+    samples += static_cast<long long>(SAMPLES_PER_ROUND) * slot_count();
+}
+
+// Sums the slot histograms over rows [from_h, to_h) and returns their peak
+quint32 Buddhabrot::merge_rows(int from_h, int to_h)
+{
+    const int w = params.w;
+    quint32 peak = 0;
+    for (int p = from_h * w; p < to_h * w; p++)
+    {
+        quint32 sum = 0;
+        for (const QVector<quint32>& histogram : histograms)
+            sum += histogram[p];
+        density[p] = sum;
+        peak = std::max(peak, sum);
+    }
+    return peak;
+}
+
+// The square root keeps the faint outer orbits visible next to the bright core
+void Buddhabrot::colour_rows(int from_h, int to_h, quint32 max_density, unsigned char* bits, int per_line) const
+{
+    const int w = params.w;
+    const QColor colour = params.color;
+    const double norm = max_density > 0 ? 1.0 / max_density : 0.0;
+    for (int y = from_h; y < to_h; y++)
+    {
+        unsigned char* bit_line = bits + y * per_line;
+        for (int x = 0; x < w; x++)
+        {
+            double val = std::sqrt(density[y * w + x] * norm);
+            *bit_line++ = val * colour.red();
+            *bit_line++ = val * colour.green();
+            *bit_line++ = val * colour.blue();
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef BUDDHABROT_H
+#define BUDDHABROT_H
+
+#include <random>
+#include <QVector>
+#include "fractal.h"
+
+// Orbit density of the escaping points of the plane. Every sampling slot owns a
+// private histogram, so the hot loop writes plain memory; the histograms are
+// summed band by band only when a frame is shown.
+//
+// Starting points are drawn from a coarse map of the plane: cells whose corners
+// all stay bounded are skipped, cells on the set boundary are drawn EDGE_WEIGHT
+// times as often and each of their hits counts 1 instead of EDGE_WEIGHT, so the
+// expected density is the same as with uniform sampling.
+class Buddhabrot
+{
+public:
+    constexpr static int GRID_SIZE = 256;
+    constexpr static double PLANE_RADIUS = 2.0;
+    constexpr static int EDGE_WEIGHT = 4;
+    constexpr static int SAMPLES_PER_ROUND = 1 << 14;
+
+    Buddhabrot(const frame_params& params, int slot_count);
+
+    int slot_count() const;
+    long long sample_count() const;
+
+    void count_map_row(int y);
+    void build_map();
+    void sample(int slot);
+    void finish_round();
+    quint32 merge_rows(int from_h, int to_h);
+    void colour_rows(int from_h, int to_h, quint32 max_density, unsigned char* bits, int per_line) const;
+private:
+    frame_params params;
+    frame_params map_params;
+    fractal::kernel counter;
+    QVector<int> corner_iters;
+    QVector<int> cells;
+    QVector<int> cell_hits;
+    QVector<qint64> cell_bounds;
+    QVector<QVector<quint32>> histograms;
+    QVector<QVector<double>> traces;
+    QVector<std::mt19937_64> generators;
+    QVector<quint32> density;
+    long long samples;
+};
+
+#endif // BUDDHABROT_H
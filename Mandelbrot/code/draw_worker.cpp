@@ -1,9 +1,11 @@
 #include "draw_worker.h"
+#include "buddhabrot.h"
 #include "drawspace.h"
+#include <algorithm>
 #include <cassert>
-#include <complex>
+#include <cmath>
+#include <cstring>
 #include <functional>
-#include <QThreadPool>
 
 Draw_worker::Draw_worker(QObject* parent) : QThread(parent)
 {}
@@ -24,26 +26,29 @@ Draw_worker::~Draw_worker()
     {
         QMutexLocker lock(&m);
         mods = thread_mods::END;
-        curr_state.cancel();
+        if (curr_state)
+            curr_state->cancel();
+        for (const std::shared_ptr<Render_batch>& batch : prefetch_batches)
+            batch->cancel();
         start_cond.wakeOne();
     }
 
     wait();
+    for (const std::shared_ptr<Render_batch>& batch : prefetch_batches)
+        batch->wait();
 }
 
-void Draw_worker::work_again(QPointF frame_center, int w, int h, double z, QColor colour, int iter_num, int color_num)
+void Draw_worker::work_again(frame_params params)
 {
     QMutexLocker lock(&m);
-    draw_args.frame_center = frame_center;
-    draw_args.w = w;
-    draw_args.h = h;
-    draw_args.zoom = z;
-    draw_args.max_iter_num = iter_num;
-    draw_args.max_color_num = color_num;
-    draw_args.color = colour;
+    draw_args = params;
+    for (const std::shared_ptr<Render_batch>& batch : prefetch_batches)
+        batch->cancel();
     if (isRunning())
     {
         mods = thread_mods::RESTART;
+        if (curr_state)
+            curr_state->cancel();
         start_cond.wakeOne();
     }
     else
@@ -52,6 +57,25 @@ void Draw_worker::work_again(QPointF frame_center, int w, int h, double z, QColo
     }
 }
 
+void Draw_worker::set_channel(std::shared_ptr<Frame_channel> new_channel)
+{
+    QMutexLocker lock(&m);
+    channel = new_channel;
+}
+
+// Frames are published from the render thread, so readers cost the window nothing
+void Draw_worker::present(const QImage& frame, const args& frame_args)
+{
+    emit frame_ready(frame);
+    std::shared_ptr<Frame_channel> target;
+    {
+        QMutexLocker lock(&m);
+        target = channel;
+    }
+    if (target)
+        target->publish(frame, frame_args);
+}
+
 void Draw_worker::run()
 {
     forever
@@ -66,30 +90,34 @@ void Draw_worker::run()
                 h = draw_args.h;
                 frame_args = draw_args;
             }
-            if (images[curr_image].width() != w || images[curr_image].height() != h)
-                images[curr_image] = images[curr_image].scaled(w, h);
-            QImage& jackal = images[curr_image];
-            curr_image = (curr_image + 1) % 2;
-
-            QVector<v_entry> segments;
-            int th_count = QThreadPool::globalInstance()->maxThreadCount() - QThreadPool::globalInstance()->activeThreadCount();
-            if (th_count < 1)
-                th_count = 1;
-
-            const int segment_h = h / th_count;
-            const int per_line = jackal.bytesPerLine();
-            for (int i = 0; i < th_count; i++)
+            if (!same_formula(frame_args, caps_args))
             {
-                unsigned char* segment = jackal.bits() + i * per_line * segment_h;
-                if (i < th_count - 1)
-                    segments.append(v_entry{segment, i * segment_h, (i + 1) * segment_h});
-                else
-                    segments.append(v_entry{segment, i * segment_h, h});
+                auto_iter_caps.clear();
+                caps_args = frame_args;
+            }
+            if (frame_args.auto_iter)
+                frame_args.max_iter_num = suggested_iter_cap(frame_args.zoom, frame_args.max_iter_num);
+            if (iter_field.size() != w * h)
+                iter_field.resize(w * h);
+
+            if (frame_args.mode == render_mode::BUDDHABROT)
+            {
+                render_density(frame_args);
+                if (mods == thread_mods::END)
+                    return;
+                break;
+            }
+
+            // A frame made of cached tiles is ready at once, the preview would only flicker
+            if (!frame_args.prefetch || !is_cached(frame_args))
+            {
+                if (images[curr_image].width() != w || images[curr_image].height() != h)
+                    images[curr_image] = images[curr_image].scaled(w, h);
+                QImage& jackal = images[curr_image];
+                curr_image = (curr_image + 1) % 2;
+                if (render_pass(true, jackal, frame_args))
+                    present(jackal, frame_args);
             }
-            curr_state = QtConcurrent::map(segments, [this, per_line, frame_args](v_entry& entry)
-                                           { process_jackal(entry, per_line, frame_args); });
-            curr_state.waitForFinished();
-            emit frame_ready(jackal);
 
             bool restart_flag = false;
             switch (mods)
@@ -102,40 +130,44 @@ void Draw_worker::run()
             if (restart_flag)
                 break;
 
-            if (images[curr_image].width() != w || images[curr_image].height() != h)
-                images[curr_image] = images[curr_image].scaled(w, h);
-            QImage& normal = images[curr_image];
-            curr_image = (curr_image + 1) % 2;
-            for (int i = 0; i < th_count; i++)
+            bool refine = true;
+            while (refine)
             {
-                unsigned char* segment = normal.bits() + i * per_line * segment_h;
-                segments[i].segment_ptr = segment;
-            }
-            curr_state = QtConcurrent::map(segments, [this, per_line, frame_args](v_entry& entry)
-                                           { process(entry, per_line, frame_args); });
+                if (images[curr_image].width() != w || images[curr_image].height() != h)
+                    images[curr_image] = images[curr_image].scaled(w, h);
+                QImage& normal = images[curr_image];
+                curr_image = (curr_image + 1) % 2;
+                if (frame_args.prefetch)
+                    render_cached(normal, frame_args);
+                else
+                    render_pass(false, normal, frame_args);
 
-            while(!curr_state.isFinished())
-            {
-                if (mods != thread_mods::NO_CHANGE)
+                switch (mods)
                 {
-                    curr_state.cancel();
-                    curr_state.waitForFinished();
-                    break;
+                case thread_mods::END: return;
+                case thread_mods::RESTART: restart_flag = true; break;
+                case thread_mods::NO_CHANGE: break;
+                default: assert((false) && "No such state expected");
                 }
-            }
+                if (restart_flag)
+                    break;
 
-            restart_flag = false;
-            switch (mods)
-            {
-            case thread_mods::END: return;
-            case thread_mods::RESTART: restart_flag = true; break;
-            case thread_mods::NO_CHANGE: break;
-            default: assert((false) && "No such state expected");
+                present(normal, frame_args);
+                refine = frame_args.auto_iter && raise_iter_cap(frame_args);
+                if (refine || frame_args.aa_samples < 1)
+                    continue;
+
+                int refined = 0;
+                if (supersample_pass(normal, frame_args, refined))
+                {
+                    present(normal, frame_args);
+                    emit supersampled(static_cast<double>(refined) / (w * h));
+                }
             }
             if (restart_flag)
                 break;
-
-            emit frame_ready(normal);
+            if (frame_args.prefetch)
+                start_prefetch(frame_args);
         } while(false);
 
         QMutexLocker lock(&m);
@@ -152,57 +184,373 @@ void Draw_worker::run()
     }
 }
 
-void Draw_worker::process_jackal(v_entry &entry, int bits_per_line, args frame_args)
+bool Draw_worker::render_pass(bool is_jackal, QImage& image, const args& frame_args)
 {
-    fill_bit_field(true, entry.segment_ptr, bits_per_line, entry.from_h, entry.to_h, frame_args);
+    Render_pool& pool = Render_pool::instance();
+    const int w = frame_args.w;
+    const int per_line = image.bytesPerLine();
+    const row_mirror mirror = find_row_mirror(frame_args);
+    const int rows = mirror.compute_to - mirror.compute_from;
+
+    QVector<v_entry> segments;
+    int band_count = std::min(rows, pool.thread_count() * BANDS_PER_THREAD);
+    if (band_count < 1)
+        band_count = 1;
+
+    const int segment_h = rows / band_count;
+    for (int i = 0; i < band_count; i++)
+    {
+        int from_h = mirror.compute_from + i * segment_h;
+        int to_h = (i < band_count - 1) ? from_h + segment_h : mirror.compute_to;
+        segments.append(v_entry{image.bits() + from_h * per_line, from_h, to_h});
+    }
+    const fractal::kernel counter = fractal::select_kernel(frame_args);
+    {
+        QMutexLocker locker(&m);
+        curr_state = pool.submit(band_count, [this, &segments, &counter, is_jackal, per_line, frame_args](int i)
+                                 {
+                                     if (is_jackal)
+                                         process_jackal(segments[i], per_line, frame_args, counter);
+                                     else
+                                         process(segments[i], per_line, frame_args, counter);
+                                 });
+    }
+    curr_state->wait();
+    if (curr_state->is_cancelled())
+        return false;
+
+    for (int y = mirror.mirror_from; y < mirror.mirror_to; y++)
+    {
+        int src_y = mirror.mirror_sum - y;
+        std::memcpy(image.bits() + y * per_line, image.bits() + src_y * per_line, w * 3);
+        std::memcpy(iter_field.data() + y * w, iter_field.data() + src_y * w, w * sizeof(int));
+    }
+    return true;
 }
-void Draw_worker::process(v_entry& entry, int bits_per_line, args frame_args)
+
+bool Draw_worker::supersample_pass(QImage& image, const args& frame_args, int& refined)
 {
-    fill_bit_field(false, entry.segment_ptr, bits_per_line, entry.from_h, entry.to_h, frame_args);
+    Render_pool& pool = Render_pool::instance();
+    const int w = frame_args.w, h = frame_args.h;
+    const int per_line = image.bytesPerLine();
+    const int band_count = std::max(std::min(h, pool.thread_count() * BANDS_PER_THREAD), 1);
+    const int segment_h = h / band_count;
+
+    QVector<int> band_refined(band_count, 0);
+    const fractal::kernel counter = fractal::select_kernel(frame_args);
+    {
+        QMutexLocker locker(&m);
+        curr_state = pool.submit(band_count, [&, w, h, per_line, segment_h, band_count](int i)
+                                 {
+                                     int from_h = i * segment_h;
+                                     int to_h = (i < band_count - 1) ? from_h + segment_h : h;
+                                     for (int y = from_h; y < to_h && mods == thread_mods::NO_CHANGE; y++)
+                                     {
+                                         const int* iter_line = iter_field.constData() + y * w;
+                                         band_refined[i] += fractal::supersample_row(counter, frame_args, y,
+                                                                                     y > 0 ? iter_line - w : nullptr, iter_line,
+                                                                                     y + 1 < h ? iter_line + w : nullptr,
+                                                                                     image.bits() + y * per_line);
+                                     }
+                                 });
+    }
+    curr_state->wait();
+    if (curr_state->is_cancelled() || mods != thread_mods::NO_CHANGE)
+        return false;
+
+    refined = 0;
+    for (int count : band_refined)
+        refined += count;
+    return true;
 }
 
-void Draw_worker::fill_bit_field(bool is_jackal, unsigned char* bit_field, const std::size_t per_line, int from_h, int to_h, args frame_args)
+// Shows the orbit density after every sampling round until the frame changes
+// or DENSITY_ROUNDS rounds are in
+void Draw_worker::render_density(const args& frame_args)
 {
-    int step;
-    int w = frame_args.w;
-    QColor colour = frame_args.color;
-    step = is_jackal ? (w / 40) : 1;
+    Render_pool& pool = Render_pool::instance();
+    const int w = frame_args.w, h = frame_args.h;
+    Buddhabrot density(frame_args, pool.thread_count());
+    {
+        QMutexLocker locker(&m);
+        curr_state = pool.submit(Buddhabrot::GRID_SIZE + 1, [&density](int y)
+                                 {
+                                     density.count_map_row(y);
+                                 });
+    }
+    curr_state->wait();
+    if (curr_state->is_cancelled())
+        return;
+    density.build_map();
 
-    for (int y = from_h; y < to_h; y++)
+    const int band_count = std::max(std::min(h, pool.thread_count() * BANDS_PER_THREAD), 1);
+    const int segment_h = h / band_count;
+    QVector<quint32> band_peaks(band_count);
+    for (int round = 0; round < DENSITY_ROUNDS && mods == thread_mods::NO_CHANGE; round++)
     {
-        if (!is_jackal && mods != thread_mods::NO_CHANGE)
+        // One task per slot, so no two threads ever share a histogram
+        {
+            QMutexLocker locker(&m);
+            curr_state = pool.submit(density.slot_count(), [&density](int slot)
+                                     {
+                                         density.sample(slot);
+                                     });
+        }
+        curr_state->wait();
+        if (curr_state->is_cancelled())
             return;
+        density.finish_round();
 
-        unsigned char* bit_line = bit_field + per_line * (y - from_h);
-        for (int x = 0; x < w; x += step)
         {
-            double val = count_value(frame_args.frame_center, x, y, w, frame_args.h,
-                                     frame_args.zoom, frame_args.max_iter_num, frame_args.max_color_num);
-            for (int i = 0; i < step && (x + i < w); i++)
-            {
-                *bit_line++ = val * colour.red();
-                *bit_line++ = val * colour.green();
-                *bit_line++ = val * colour.blue();
-            }
+            QMutexLocker locker(&m);
+            curr_state = pool.submit(band_count, [&, h, segment_h, band_count](int i)
+                                     {
+                                         int from_h = i * segment_h;
+                                         int to_h = (i < band_count - 1) ? from_h + segment_h : h;
+                                         band_peaks[i] = density.merge_rows(from_h, to_h);
+                                     });
         }
+        curr_state->wait();
+        if (curr_state->is_cancelled())
+            return;
+
+        if (images[curr_image].width() != w || images[curr_image].height() != h)
+            images[curr_image] = images[curr_image].scaled(w, h);
+        QImage& image = images[curr_image];
+        curr_image = (curr_image + 1) % 2;
+        const quint32 peak = *std::max_element(band_peaks.constBegin(), band_peaks.constEnd());
+        const int per_line = image.bytesPerLine();
+        {
+            QMutexLocker locker(&m);
+            curr_state = pool.submit(band_count, [&, h, segment_h, band_count, peak, per_line](int i)
+                                     {
+                                         int from_h = i * segment_h;
+                                         int to_h = (i < band_count - 1) ? from_h + segment_h : h;
+                                         density.colour_rows(from_h, to_h, peak, image.bits(), per_line);
+                                     });
+        }
+        curr_state->wait();
+        if (curr_state->is_cancelled())
+            return;
+        present(image, frame_args);
     }
 }
 
-double Draw_worker::count_value(QPointF frame_center, int pos_x, int pos_y, int window_w, int window_h, double zoom, int max_iter_num, int max_color_num)
+bool Draw_worker::is_cached(const args& frame_args)
 {
-    std::complex<double> c(pos_x - window_w / 2.0, pos_y - window_h / 2.0);
-    std::complex<double> offset(frame_center.x(), frame_center.y());
+    const Tile_cache::grid g = Tile_cache::grid_for(frame_args);
+    for (const Tile_cache::tile_pos& pos : Tile_cache::tiles_in(g, 0, 0, frame_args.w, frame_args.h))
+    {
+        if (!tile_cache.contains(g, pos))
+            return false;
+    }
+    return true;
+}
+
+// The frame is assembled from grid tiles, missing ones are counted and kept
+bool Draw_worker::render_cached(QImage& image, const args& frame_args)
+{
+    Render_pool& pool = Render_pool::instance();
+    const int w = frame_args.w, h = frame_args.h;
+    const int per_line = image.bytesPerLine();
+    const int tile_size = Tile_cache::TILE_SIZE;
+    const Tile_cache::grid g = Tile_cache::grid_for(frame_args);
+    const QVector<Tile_cache::tile_pos> tiles = Tile_cache::tiles_in(g, 0, 0, w, h);
+
+    {
+        QMutexLocker locker(&m);
+        curr_state = pool.submit(tiles.size(), [this, &g, &tiles, w, h, tile_size](int i)
+                                 {
+                                     QVector<int> tile(tile_size * tile_size);
+                                     if (!tile_cache.fetch(g, tiles[i], tile.data()))
+                                     {
+                                         if (mods != thread_mods::NO_CHANGE)
+                                             return;
+                                         Tile_cache::count_tile(g, tiles[i], tile.data());
+                                         tile_cache.store(g, tiles[i], tile.data());
+                                     }
+
+                                     const qint64 left = tiles[i].x * tile_size - g.origin_x;
+                                     const qint64 top = tiles[i].y * tile_size - g.origin_y;
+                                     const int from_x = static_cast<int>(std::max<qint64>(left, 0));
+                                     const int to_x = static_cast<int>(std::min<qint64>(left + tile_size, w));
+                                     for (qint64 y = std::max<qint64>(top, 0); y < std::min<qint64>(top + tile_size, h); y++)
+                                     {
+                                         std::memcpy(iter_field.data() + y * w + from_x,
+                                                     tile.constData() + (y - top) * tile_size + (from_x - left),
+                                                     (to_x - from_x) * sizeof(int));
+                                     }
+                                 });
+    }
+    curr_state->wait();
+    if (curr_state->is_cancelled() || mods != thread_mods::NO_CHANGE)
+        return false;
+
+    const int band_count = std::max(std::min(h, pool.thread_count() * BANDS_PER_THREAD), 1);
+    const int segment_h = h / band_count;
+    {
+        QMutexLocker locker(&m);
+        curr_state = pool.submit(band_count, [&, w, h, per_line, segment_h, band_count](int i)
+                                 {
+                                     int from_h = i * segment_h;
+                                     int to_h = (i < band_count - 1) ? from_h + segment_h : h;
+                                     for (int y = from_h; y < to_h; y++)
+                                         fractal::colour_row(frame_args, iter_field.constData() + y * w, image.bits() + y * per_line);
+                                 });
+    }
+    curr_state->wait();
+    return !curr_state->is_cancelled();
+}
+
+// While the window waits for input, the lowest priority fills the cache with a
+// ring of tiles around the view and with the view one wheel step deeper. The
+// wheel keeps the center in place, so that deeper view is centered here as well.
+void Draw_worker::start_prefetch(const args& frame_args)
+{
+    const int ring = PREFETCH_RING * Tile_cache::TILE_SIZE;
+    QVector<Tile_cache::grid> grids;
+    QVector<Tile_cache::tile_pos> tiles;
+
+    const Tile_cache::grid around = Tile_cache::grid_for(frame_args);
+    for (const Tile_cache::tile_pos& pos : Tile_cache::tiles_in(around, -ring, -ring, frame_args.w + ring, frame_args.h + ring))
+    {
+        grids.append(around);
+        tiles.append(pos);
+    }
+
+    args deeper_args = frame_args;
+    deeper_args.zoom *= drawspace::zoom_step(1);
+    const Tile_cache::grid deeper = Tile_cache::grid_for(deeper_args);
+    for (const Tile_cache::tile_pos& pos : Tile_cache::tiles_in(deeper, 0, 0, frame_args.w, frame_args.h))
+    {
+        grids.append(deeper);
+        tiles.append(pos);
+    }
+
+    QMutexLocker locker(&m);
+    if (mods != thread_mods::NO_CHANGE)
+        return;
+    prefetch_batches.erase(std::remove_if(prefetch_batches.begin(), prefetch_batches.end(),
+                                          [](const std::shared_ptr<Render_batch>& batch) { return batch->is_finished(); }),
+                           prefetch_batches.end());
+    Render_pool& pool = Render_pool::instance();
+    prefetch_batches.append(pool.submit(tiles.size(), [this, grids, tiles](int i)
+                                        {
+                                            if (tile_cache.contains(grids[i], tiles[i]))
+                                                return;
+                                            QVector<int> tile(Tile_cache::TILE_SIZE * Tile_cache::TILE_SIZE);
+                                            Tile_cache::count_tile(grids[i], tiles[i], tile.data());
+                                            tile_cache.store(grids[i], tiles[i], tile.data());
+                                        }, Render_pool::priority::PREFETCH));
+}
+
+// The set is symmetric about the real axis, so a row whose imaginary part is the
+// negation of an already computed row's is a copy of it. Row y maps to im(c) =
+// (y - h/2) * zoom + center.y, hence row y mirrors row (h - 2 * center.y / zoom) - y.
+Draw_worker::row_mirror Draw_worker::find_row_mirror(const args& frame_args) const
+{
+    const int h = frame_args.h;
+    row_mirror no_mirror{0, h, 0, 0, 0};
+    if (!fractal::is_mirrored(frame_args))
+        return no_mirror;
+
+    double shift = 2 * frame_args.frame_center.y() / frame_args.zoom;
+    if (std::abs(shift) > 2.0 * h || std::abs(shift - std::round(shift)) > MIRROR_EPS)
+        return no_mirror;
+
+    const int sum = h - static_cast<int>(std::round(shift));
+    if (sum <= 0 || sum >= 2 * h - 1)
+        return no_mirror;
+
+    if (sum >= h)
+    {
+        // The axis is in the lower half: copy the rows below it from above
+        const int mirror_from = sum / 2 + 1;
+        return row_mirror{0, mirror_from, mirror_from, h, sum};
+    }
+    else
+    {
+        const int mirror_to = (sum + 1) / 2;
+        return row_mirror{mirror_to, h, 0, mirror_to, sum};
+    }
+}
+
+// Settled iteration caps only carry over between frames of the same picture
+bool Draw_worker::same_formula(const args& lhs, const args& rhs)
+{
+    return lhs.formula == rhs.formula && lhs.power == rhs.power
+        && lhs.julia == rhs.julia && lhs.julia_c == rhs.julia_c;
+}
+
+int Draw_worker::suggested_iter_cap(double zoom, int fallback) const
+{
+    if (auto_iter_caps.isEmpty())
+        return fallback;
 
-    c *= zoom;
-    c += offset;
-    std::complex<double> z = 0.0;
-    for (int iter = 0; iter < max_iter_num; iter++)
+    // Caps are remembered per power-of-two zoom depth, the nearest known depth wins
+    int depth = static_cast<int>(std::floor(-std::log2(zoom)));
+    auto it = auto_iter_caps.lowerBound(depth);
+    if (it == auto_iter_caps.end())
+        return auto_iter_caps.last();
+    if (it.key() == depth || it == auto_iter_caps.begin())
+        return it.value();
+    auto prev = it;
+    --prev;
+    return (depth - prev.key() <= it.key() - depth) ? prev.value() : it.value();
+}
+
+// Doubling the cap is worth it while a noticeable share of the pixels that were
+// still running at half the cap escape before reaching it. Otherwise the cap is
+// settled, trimmed down to what the frame actually used and remembered for this depth.
+bool Draw_worker::raise_iter_cap(args& frame_args)
+{
+    const int cap = frame_args.max_iter_num;
+    int late = 0, interior = 0, max_escape = 0;
+    for (int iter : iter_field)
     {
-        if (std::norm(z) >= 4.0)
+        if (iter >= cap)
+            interior++;
+        else
         {
-            return static_cast<double>(iter % (max_color_num + 1)) / max_color_num;
+            max_escape = std::max(max_escape, iter);
+            if (iter >= cap / 2)
+                late++;
         }
-        z = z * z + c;
     }
-    return 0;
+
+    const int depth = static_cast<int>(std::floor(-std::log2(frame_args.zoom)));
+    if (late > 0 && late >= AUTO_ITER_GAIN * (late + interior) && cap < AUTO_ITER_MAX)
+    {
+        frame_args.max_iter_num = std::min(cap * 2, AUTO_ITER_MAX);
+        return true;
+    }
+
+    int settled = std::max(std::min(2 * max_escape, cap), AUTO_ITER_MIN);
+    auto_iter_caps[depth] = settled;
+    emit iter_num_changed(settled);
+    return false;
+}
+
+void Draw_worker::process_jackal(v_entry &entry, int bits_per_line, args frame_args, const fractal::kernel& counter)
+{
+    fill_bit_field(true, entry.segment_ptr, bits_per_line, entry.from_h, entry.to_h, frame_args, counter);
+}
+void Draw_worker::process(v_entry& entry, int bits_per_line, args frame_args, const fractal::kernel& counter)
+{
+    fill_bit_field(false, entry.segment_ptr, bits_per_line, entry.from_h, entry.to_h, frame_args, counter);
+}
+
+void Draw_worker::fill_bit_field(bool is_jackal, unsigned char* bit_field, const std::size_t per_line, int from_h, int to_h, args frame_args,
+                                 const fractal::kernel& counter)
+{
+    int w = frame_args.w;
+    int step = is_jackal ? std::max(w / 40, 1) : 1;
+
+    for (int y = from_h; y < to_h; y++)
+    {
+        if (!is_jackal && mods != thread_mods::NO_CHANGE)
+            return;
+
+        fractal::fill_row(counter, frame_args, y, step, iter_field.data() + y * w, bit_field + per_line * (y - from_h));
+    }
 }
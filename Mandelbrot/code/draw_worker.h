@@ -2,9 +2,14 @@
 #define WORKER_H
 
 #include <atomic>
+#include <memory>
 #include <QThread>
 #include <QImage>
-#include <QtConcurrent/QtConcurrent>
+#include <QMap>
+#include "fractal.h"
+#include "frame_channel.h"
+#include "render_pool.h"
+#include "tile_cache.h"
 
 class Draw_worker;
 #include "drawspace.h"
@@ -19,23 +24,34 @@ class Draw_worker : public QThread
 {
     Q_OBJECT
 
-    struct args
-    {
-        int w, h, max_iter_num, max_color_num;
-        double zoom;
-        QPointF frame_center;
-        QColor color;
-    };
+    using args = frame_params;
 public:
     explicit Draw_worker(QObject *parent = nullptr);
     explicit Draw_worker(drawspace* ptr, QObject* parent = nullptr);
     ~Draw_worker();
 
-    void process(v_entry &entry, int bits_per_line, args draw_args);
-    void process_jackal(v_entry &entry, int bits_per_line, args draw_args);
+    void process(v_entry &entry, int bits_per_line, args draw_args, const fractal::kernel& counter);
+    void process_jackal(v_entry &entry, int bits_per_line, args draw_args, const fractal::kernel& counter);
     virtual void run() override;
+    void set_channel(std::shared_ptr<Frame_channel> new_channel);
 private:
-    QFuture<void> curr_state;
+    struct row_mirror
+    {
+        int compute_from, compute_to;
+        int mirror_from, mirror_to, mirror_sum;
+    };
+
+    constexpr static int BANDS_PER_THREAD = 4;
+    constexpr static double MIRROR_EPS = 1e-6;
+    constexpr static int AUTO_ITER_MIN = 64;
+    constexpr static int AUTO_ITER_MAX = 100000;
+    constexpr static double AUTO_ITER_GAIN = 0.01;
+    constexpr static int PREFETCH_RING = 2;
+    constexpr static int DENSITY_ROUNDS = 256;
+    std::shared_ptr<Render_batch> curr_state;
+    // Cancelled prefetch tasks that already run still write to tile_cache, so
+    // every batch is kept until it is finished
+    QVector<std::shared_ptr<Render_batch>> prefetch_batches;
     QMutex m;
     QWaitCondition start_cond;
     enum class thread_mods { NO_CHANGE, RESTART, END };
@@ -44,14 +60,32 @@ private:
     args draw_args;
     QImage images[2];
     std::atomic_size_t curr_image;
+    QVector<int> iter_field;
+    QMap<int, int> auto_iter_caps;
+    args caps_args;
+    Tile_cache tile_cache;
+    std::shared_ptr<Frame_channel> channel;
 
-    void fill_bit_field(bool is_jackal, unsigned char* bit_field, const std::size_t per_line, int from_h, int to_h, args draw_args);
-    double count_value(QPointF frame_center, int pos_x, int pos_y, int window_w, int window_h, double zoom, int max_iter_num, int max_color_num);
+    void present(const QImage& frame, const args& frame_args);
+    bool render_pass(bool is_jackal, QImage& image, const args& frame_args);
+    bool supersample_pass(QImage& image, const args& frame_args, int& refined);
+    bool is_cached(const args& frame_args);
+    bool render_cached(QImage& image, const args& frame_args);
+    void start_prefetch(const args& frame_args);
+    void render_density(const args& frame_args);
+    row_mirror find_row_mirror(const args& frame_args) const;
+    static bool same_formula(const args& lhs, const args& rhs);
+    int suggested_iter_cap(double zoom, int fallback) const;
+    bool raise_iter_cap(args& frame_args);
+    void fill_bit_field(bool is_jackal, unsigned char* bit_field, const std::size_t per_line, int from_h, int to_h, args draw_args,
+                        const fractal::kernel& counter);
 public slots:
-    void work_again(QPointF pos, int w, int h, double zoom, QColor colour, int iter_num, int color_num);
+    void work_again(frame_params params);
 
 signals:
     void frame_ready(QImage frame);
+    void iter_num_changed(int iter_num);
+    void supersampled(double refined_fraction);
 };
 
 #endif // WORKER_H
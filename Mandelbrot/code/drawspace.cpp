@@ -18,9 +18,19 @@ drawspace::drawspace(QWidget *parent) :
   , colour(DEFAULT_COLOR)
   , iter_num(DEFAULT_ITER_NUM)
   , color_num(DEFAULT_COLOR_NUM)
+  , auto_iter(false)
+  , antialiasing(false)
+  , prefetch(false)
+  , formula(formula_kind::MANDELBROT)
+  , power(fractal::MIN_POWER)
+  , julia(false)
+  , julia_c(0, 0)
+  , mode(render_mode::ESCAPE_TIME)
   , worker(new Draw_worker(this, this))
 {
     connect(worker.get(), &Draw_worker::frame_ready, this, &drawspace::queue_frame);
+    connect(worker.get(), &Draw_worker::iter_num_changed, this, &drawspace::update_iter_num);
+    connect(worker.get(), &Draw_worker::supersampled, this, &drawspace::supersampled);
 }
 
 const QColor& drawspace::get_colour() const
@@ -49,6 +59,38 @@ int drawspace::get_colour_num() const
 {
     return color_num;
 }
+bool drawspace::get_auto_iter() const
+{
+    return auto_iter;
+}
+bool drawspace::get_antialiasing() const
+{
+    return antialiasing;
+}
+bool drawspace::get_prefetch() const
+{
+    return prefetch;
+}
+formula_kind drawspace::get_formula() const
+{
+    return formula;
+}
+int drawspace::get_power() const
+{
+    return power;
+}
+bool drawspace::get_julia() const
+{
+    return julia;
+}
+QPointF drawspace::get_julia_c() const
+{
+    return julia_c;
+}
+render_mode drawspace::get_mode() const
+{
+    return mode;
+}
 
 void drawspace::set_iter_num(int new_iter_num)
 {
@@ -60,11 +102,45 @@ void drawspace::set_colour_num(int new_colour_num)
     if (new_colour_num > 0)
         color_num = new_colour_num;
 }
+void drawspace::set_auto_iter(bool new_auto_iter)
+{
+    auto_iter = new_auto_iter;
+}
+void drawspace::set_antialiasing(bool new_antialiasing)
+{
+    antialiasing = new_antialiasing;
+}
+void drawspace::set_prefetch(bool new_prefetch)
+{
+    prefetch = new_prefetch;
+}
+void drawspace::set_formula(formula_kind new_formula, int new_power)
+{
+    formula = new_formula;
+    power = std::clamp(new_power, fractal::MIN_POWER, fractal::MAX_POWER);
+}
+void drawspace::set_julia(bool new_julia, QPointF new_julia_c)
+{
+    julia = new_julia;
+    julia_c = new_julia_c;
+}
+void drawspace::set_mode(render_mode new_mode)
+{
+    mode = new_mode;
+}
 
 void drawspace::reset_nums()
 {
     iter_num = DEFAULT_ITER_NUM;
     color_num = DEFAULT_COLOR_NUM;
+    auto_iter = false;
+    antialiasing = false;
+    prefetch = false;
+    formula = formula_kind::MANDELBROT;
+    power = fractal::MIN_POWER;
+    julia = false;
+    julia_c = QPointF(0, 0);
+    mode = render_mode::ESCAPE_TIME;
 }
 
 void drawspace::reset()
@@ -76,15 +152,45 @@ void drawspace::reset()
     redraw_field();
 }
 
+bool drawspace::share_frames(const QString& name, QString& error)
+{
+    std::shared_ptr<Frame_channel> channel = std::make_shared<Frame_channel>(name);
+    if (!channel->open(error))
+        return false;
+    worker->set_channel(channel);
+    return true;
+}
+
 void drawspace::paintEvent(QPaintEvent*)
 {
     QPainter painter(this);
     painter.drawImage(0, 0, curr_frame);
 }
 
+frame_params drawspace::current_params() const
+{
+    frame_params params;
+    params.frame_center = pos;
+    params.w = width();
+    params.h = height();
+    params.zoom = zoom;
+    params.color = colour;
+    params.max_iter_num = iter_num;
+    params.max_color_num = color_num;
+    params.auto_iter = auto_iter;
+    params.aa_samples = antialiasing ? AA_SAMPLES : 0;
+    params.prefetch = prefetch;
+    params.formula = formula;
+    params.power = power;
+    params.julia = julia;
+    params.julia_c = julia_c;
+    params.mode = mode;
+    return params;
+}
+
 void drawspace::redraw_field()
 {
-    emit need_new_frame(pos, width(), height(), zoom, colour, iter_num, color_num);
+    emit need_new_frame(current_params());
 }
 
 void drawspace::queue_frame(QImage frame)
@@ -93,6 +199,15 @@ void drawspace::queue_frame(QImage frame)
     update();
 }
 
+void drawspace::update_iter_num(int new_iter_num)
+{
+    if (auto_iter && new_iter_num != iter_num)
+    {
+        iter_num = new_iter_num;
+        emit iter_num_changed(iter_num);
+    }
+}
+
 void drawspace::resizeEvent(QResizeEvent*)
 {
     redraw_field();
@@ -131,11 +246,15 @@ void drawspace::mouseReleaseEvent(QMouseEvent* event)
     }
 }
 
+double drawspace::zoom_step(int notches)
+{
+    return std::pow(WHEEL_STEP, notches);
+}
+
 void drawspace::wheelEvent(QWheelEvent* event)
 {
     int deg = (event->angleDelta() / 8).y();
-    const double mod = 0.9;
-    double step = std::pow(mod, deg / 15);
+    double step = zoom_step(deg / 15);
     if (event->modifiers() == Qt::ControlModifier)
     {
         step = (step > 1) ? step * 2 : step / 2;
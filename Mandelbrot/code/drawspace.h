@@ -20,11 +20,29 @@ public:
     const QColor& get_colour() const;
     int get_iter_num() const;
     int get_colour_num() const;
+    bool get_auto_iter() const;
+    bool get_antialiasing() const;
+    formula_kind get_formula() const;
+    int get_power() const;
+    bool get_julia() const;
+    QPointF get_julia_c() const;
+    render_mode get_mode() const;
+    frame_params current_params() const;
+    bool get_prefetch() const;
+    void set_prefetch(bool prefetch);
+
+    static double zoom_step(int notches);
     void set_colour(const QColor& colour);
     void set_iter_num(int iter_num);
     void set_colour_num(int colour_num);
+    void set_auto_iter(bool auto_iter);
+    void set_antialiasing(bool antialiasing);
+    void set_formula(formula_kind formula, int power);
+    void set_julia(bool julia, QPointF julia_c);
+    void set_mode(render_mode mode);
     void reset();
     void reset_nums();
+    bool share_frames(const QString& name, QString& error);
 private:
     virtual void paintEvent (QPaintEvent* event) override;
     virtual void wheelEvent (QWheelEvent* event) override;
@@ -39,19 +57,32 @@ private:
     constexpr static std::size_t DEFAULT_ITER_NUM = 100;
     constexpr static double DEFAULT_ZOOM = 0.005;
     constexpr static QColor DEFAULT_COLOR = QColor(127, 127, 255);
+    constexpr static int AA_SAMPLES = 8;
+    constexpr static double WHEEL_STEP = 0.9;
     double zoom;
     QPointF pos;
     QPointF mouse_anchor;
     QColor colour;
     int iter_num;
     int color_num;
+    bool auto_iter;
+    bool antialiasing;
+    bool prefetch;
+    formula_kind formula;
+    int power;
+    bool julia;
+    QPointF julia_c;
+    render_mode mode;
     QImage curr_frame;
     std::unique_ptr<Draw_worker> worker;
 
 public slots:
     void queue_frame(QImage frame);
+    void update_iter_num(int iter_num);
 signals:
-    void need_new_frame(QPointF pos, int w, int h, double zoom, QColor colour, int iter_num, int color_num);
+    void need_new_frame(frame_params params);
+    void iter_num_changed(int iter_num);
+    void supersampled(double refined_fraction);
 };
 
 #endif // DRAWSPACE_H
@@ -0,0 +1,39 @@
+#include "export_job.h"
+
+Export_job::Export_job(Poster_renderer::settings cfg, QObject* parent)
+    : QThread(parent)
+    , out_path(cfg.path)
+    , renderer(cfg)
+    , ok(false)
+{}
+
+Export_job::~Export_job()
+{
+    cancel();
+    wait();
+}
+
+void Export_job::cancel()
+{
+    renderer.cancel();
+}
+
+bool Export_job::succeeded() const
+{
+    return ok;
+}
+
+QString Export_job::error_string() const
+{
+    return renderer.error_string();
+}
+
+QString Export_job::path() const
+{
+    return out_path;
+}
+
+void Export_job::run()
+{
+    ok = renderer.render();
+}
@@ -0,0 +1,27 @@
+#ifndef EXPORT_JOB_H
+#define EXPORT_JOB_H
+
+#include <QThread>
+#include "poster_renderer.h"
+
+// Renders a poster from the window on its own thread. Its bands go to the
+// render pool at background priority, so the interactive view stays first.
+class Export_job : public QThread
+{
+public:
+    explicit Export_job(Poster_renderer::settings cfg, QObject* parent = nullptr);
+    ~Export_job();
+
+    void cancel();
+    bool succeeded() const;
+    QString error_string() const;
+    QString path() const;
+
+    virtual void run() override;
+private:
+    QString out_path;
+    Poster_renderer renderer;
+    bool ok;
+};
+
+#endif // EXPORT_JOB_H
@@ -0,0 +1,318 @@
+#include "fractal.h"
+#include <cmath>
+#include <cstdint>
+
+std::complex<double> fractal::pixel_point(QPointF frame_center, double pos_x, double pos_y, int window_w, int window_h, double zoom)
+{
+    std::complex<double> c(pos_x - window_w / 2.0, pos_y - window_h / 2.0);
+    std::complex<double> offset(frame_center.x(), frame_center.y());
+
+    c *= zoom;
+    c += offset;
+    return c;
+}
+
+namespace
+{
+    template<int Power>
+    struct multibrot
+    {
+        static void step(double& re, double& im, double c_re, double c_im)
+        {
+            double z_re = re, z_im = im;
+            for (int i = 1; i < Power; i++)
+            {
+                double next_re = z_re * re - z_im * im;
+                z_im = z_re * im + z_im * re;
+                z_re = next_re;
+            }
+            re = z_re + c_re;
+            im = z_im + c_im;
+        }
+    };
+
+    struct burning_ship
+    {
+        static void step(double& re, double& im, double c_re, double c_im)
+        {
+            double next_re = re * re - im * im + c_re;
+            im = 2 * std::abs(re * im) + c_im;
+            re = next_re;
+        }
+    };
+
+    template<class Formula>
+    int escape_time(double re, double im, double c_re, double c_im, int max_iter_num)
+    {
+        for (int iter = 0; iter < max_iter_num; iter++)
+        {
+            if (re * re + im * im >= 4.0)
+                return iter;
+            Formula::step(re, im, c_re, c_im);
+        }
+        return max_iter_num;
+    }
+
+    template<class Formula>
+    int trace_orbit(double c_re, double c_im, int max_iter_num, double* trace)
+    {
+        double re = 0.0, im = 0.0;
+        for (int iter = 0; iter < max_iter_num; iter++)
+        {
+            Formula::step(re, im, c_re, c_im);
+            trace[2 * iter] = re;
+            trace[2 * iter + 1] = im;
+            if (re * re + im * im >= 4.0)
+                return iter + 1;
+        }
+        return 0;
+    }
+
+    // In Julia mode the pixel is the starting point and c is fixed,
+    // otherwise the orbit starts at zero and the pixel is c
+    template<class Formula, bool Julia>
+    int count_point(const frame_params& params, double pos_x, double pos_y)
+    {
+        std::complex<double> p = fractal::pixel_point(params.frame_center, pos_x, pos_y, params.w, params.h, params.zoom);
+        if (Julia)
+            return escape_time<Formula>(p.real(), p.imag(), params.julia_c.x(), params.julia_c.y(), params.max_iter_num);
+        return escape_time<Formula>(0.0, 0.0, p.real(), p.imag(), params.max_iter_num);
+    }
+
+    // Row kernels iterate LANES pixels together in plain arrays, which the compiler
+    // keeps in SIMD registers. A lane that has escaped stops counting and keeps its
+    // z, so the counts and the final |z| match the scalar loop; the group stops
+    // once every lane has escaped or the cap is reached.
+    constexpr int LANES = 4;
+
+    template<class Formula>
+    void escape_lanes(double (&re)[LANES], double (&im)[LANES], const double (&c_re)[LANES], const double (&c_im)[LANES],
+                      int max_iter_num, int (&iters)[LANES])
+    {
+        for (int l = 0; l < LANES; l++)
+            iters[l] = 0;
+        for (int iter = 0; iter < max_iter_num; iter++)
+        {
+            int running = 0;
+            for (int l = 0; l < LANES; l++)
+            {
+                const bool inside = re[l] * re[l] + im[l] * im[l] < 4.0;
+                double next_re = re[l], next_im = im[l];
+                Formula::step(next_re, next_im, c_re[l], c_im[l]);
+                re[l] = inside ? next_re : re[l];
+                im[l] = inside ? next_im : im[l];
+                iters[l] += inside;
+                running += inside;
+            }
+            if (running == 0)
+                return;
+        }
+    }
+
+    // Loads the pixels from_x, from_x + step, ... of row y into the lanes; lanes
+    // past to_x repeat the first pixel and are dropped by the caller
+    template<bool Julia>
+    int load_lanes(const frame_params& params, int y, int from_x, int to_x, int step,
+                   double (&re)[LANES], double (&im)[LANES], double (&c_re)[LANES], double (&c_im)[LANES])
+    {
+        const double row_im = (y - params.h / 2.0) * params.zoom + params.frame_center.y();
+        int count = 0;
+        for (int l = 0; l < LANES; l++)
+        {
+            const int x = (from_x + l * step < to_x) ? from_x + l * step : from_x;
+            count += (from_x + l * step < to_x);
+            const double pixel_re = (x - params.w / 2.0) * params.zoom + params.frame_center.x();
+            re[l] = Julia ? pixel_re : 0.0;
+            im[l] = Julia ? row_im : 0.0;
+            c_re[l] = Julia ? params.julia_c.x() : pixel_re;
+            c_im[l] = Julia ? params.julia_c.y() : row_im;
+        }
+        return count;
+    }
+
+    template<class Formula, bool Julia>
+    void count_span(const frame_params& params, int y, int from_x, int to_x, int step, int* span)
+    {
+        double re[LANES], im[LANES], c_re[LANES], c_im[LANES];
+        int iters[LANES];
+        for (int x = from_x; x < to_x; x += LANES * step)
+        {
+            const int count = load_lanes<Julia>(params, y, x, to_x, step, re, im, c_re, c_im);
+            escape_lanes<Formula>(re, im, c_re, c_im, params.max_iter_num, iters);
+            for (int l = 0; l < count; l++)
+                span[x - from_x + l * step] = iters[l];
+        }
+    }
+
+    template<class Formula, bool Julia>
+    void detail_span(const frame_params& params, int y, int from_x, int to_x, int* span, float* modulus)
+    {
+        double re[LANES], im[LANES], c_re[LANES], c_im[LANES];
+        int iters[LANES];
+        for (int x = from_x; x < to_x; x += LANES)
+        {
+            const int count = load_lanes<Julia>(params, y, x, to_x, 1, re, im, c_re, c_im);
+            escape_lanes<Formula>(re, im, c_re, c_im, params.max_iter_num, iters);
+            for (int l = 0; l < count; l++)
+            {
+                span[x - from_x + l] = iters[l];
+                modulus[x - from_x + l] = static_cast<float>(std::sqrt(re[l] * re[l] + im[l] * im[l]));
+            }
+        }
+    }
+
+    template<class Formula>
+    fractal::kernel make_kernel(bool julia)
+    {
+        if (julia)
+            return fractal::kernel{&count_point<Formula, true>, &count_span<Formula, true>, &trace_orbit<Formula>,
+                                   &detail_span<Formula, true>};
+        return fractal::kernel{&count_point<Formula, false>, &count_span<Formula, false>, &trace_orbit<Formula>,
+                               &detail_span<Formula, false>};
+    }
+
+    template<int Power>
+    fractal::kernel multibrot_kernel(int power, bool julia)
+    {
+        if constexpr (Power < fractal::MAX_POWER)
+        {
+            if (power > Power)
+                return multibrot_kernel<Power + 1>(power, julia);
+        }
+        return make_kernel<multibrot<Power>>(julia);
+    }
+}
+
+fractal::kernel fractal::select_kernel(const frame_params& params)
+{
+    switch (params.formula)
+    {
+    case formula_kind::MULTIBROT: return multibrot_kernel<MIN_POWER>(params.power, params.julia);
+    case formula_kind::BURNING_SHIP: return make_kernel<burning_ship>(params.julia);
+    case formula_kind::MANDELBROT: break;
+    }
+    return make_kernel<multibrot<2>>(params.julia);
+}
+
+// Polynomials with real coefficients commute with conjugation, so their pictures
+// are symmetric about the real axis unless a Julia constant breaks it
+bool fractal::is_mirrored(const frame_params& params)
+{
+    if (params.formula == formula_kind::BURNING_SHIP)
+        return false;
+    return !params.julia || params.julia_c.y() == 0;
+}
+
+double fractal::colour_value(int iter, int max_iter_num, int max_color_num)
+{
+    if (iter >= max_iter_num)
+        return 0;
+    return static_cast<double>(iter % (max_color_num + 1)) / max_color_num;
+}
+
+void fractal::fill_row(const kernel& counter, const frame_params& params, int y, int step, int* iter_line, unsigned char* bit_line)
+{
+    const int w = params.w;
+    const QColor colour = params.color;
+    counter.row(params, y, 0, w, step, iter_line);
+    for (int x = 0; x < w; x++)
+    {
+        int iter = iter_line[x - x % step];
+        double val = colour_value(iter, params.max_iter_num, params.max_color_num);
+        iter_line[x] = iter;
+        *bit_line++ = val * colour.red();
+        *bit_line++ = val * colour.green();
+        *bit_line++ = val * colour.blue();
+    }
+}
+
+void fractal::count_row(const kernel& counter, const frame_params& params, int y, int from_x, int to_x, int* iter_line)
+{
+    count_span(counter, params, y, from_x, to_x, iter_line + from_x);
+}
+
+void fractal::count_span(const kernel& counter, const frame_params& params, int y, int from_x, int to_x, int* span)
+{
+    counter.row(params, y, from_x, to_x, 1, span);
+}
+
+void fractal::colour_row(const frame_params& params, const int* iter_line, unsigned char* bit_line)
+{
+    const QColor colour = params.color;
+    for (int x = 0; x < params.w; x++)
+    {
+        double val = colour_value(iter_line[x], params.max_iter_num, params.max_color_num);
+        *bit_line++ = val * colour.red();
+        *bit_line++ = val * colour.green();
+        *bit_line++ = val * colour.blue();
+    }
+}
+
+void fractal::detail_row(const kernel& counter, const frame_params& params, int y, int* iter_line, float* modulus_line)
+{
+    counter.detail(params, y, 0, params.w, iter_line, modulus_line);
+}
+
+// Continuous escape count: the fraction comes from how far past the escape
+// radius the last step threw the orbit. Points that never escape keep max_iter_num.
+float fractal::smooth_value(const frame_params& params, int iter, float modulus)
+{
+    if (iter >= params.max_iter_num || modulus <= 1.0f)
+        return static_cast<float>(iter);
+    const double power = (params.formula == formula_kind::MULTIBROT) ? params.power : 2;
+    return static_cast<float>(iter + 1 - std::log(std::log(modulus) / std::log(2.0)) / std::log(power));
+}
+
+namespace
+{
+    double jitter(int x, int y, int sample)
+    {
+        std::uint32_t h = static_cast<std::uint32_t>(x) * 0x9E3779B1u ^ static_cast<std::uint32_t>(y) * 0x85EBCA77u
+                          ^ static_cast<std::uint32_t>(sample) * 0xC2B2AE3Du;
+        h ^= h >> 15;
+        h *= 0x2C1B3C6Du;
+        h ^= h >> 12;
+        return (h & 0xFFFFFF) / static_cast<double>(0x1000000);
+    }
+}
+
+// Pixels whose escape count differs from a 4-neighbour's by more than aa_threshold
+// get aa_samples extra jittered, stratified samples; the rest keep their colour.
+// Returns the number of refined pixels.
+int fractal::supersample_row(const kernel& counter, const frame_params& params, int y, const int* prev_line,
+                             const int* iter_line, const int* next_line, unsigned char* bit_line)
+{
+    const int w = params.w;
+    const int threshold = params.aa_threshold;
+    const int samples = params.aa_samples;
+    const int grid = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(samples))));
+    const QColor colour = params.color;
+    int refined = 0;
+
+    for (int x = 0; x < w; x++)
+    {
+        const int iter = iter_line[x];
+        bool edge = (x > 0 && std::abs(iter - iter_line[x - 1]) > threshold)
+                 || (x + 1 < w && std::abs(iter - iter_line[x + 1]) > threshold)
+                 || (prev_line && std::abs(iter - prev_line[x]) > threshold)
+                 || (next_line && std::abs(iter - next_line[x]) > threshold);
+        if (!edge)
+            continue;
+
+        double val = colour_value(iter, params.max_iter_num, params.max_color_num);
+        for (int i = 0; i < samples; i++)
+        {
+            double dx = (i % grid + jitter(x, y, 2 * i)) / grid - 0.5;
+            double dy = (i / grid + jitter(x, y, 2 * i + 1)) / grid - 0.5;
+            val += colour_value(counter.point(params, x + dx, y + dy), params.max_iter_num, params.max_color_num);
+        }
+        val /= samples + 1;
+
+        unsigned char* pixel = bit_line + x * 3;
+        pixel[0] = val * colour.red();
+        pixel[1] = val * colour.green();
+        pixel[2] = val * colour.blue();
+        refined++;
+    }
+    return refined;
+}
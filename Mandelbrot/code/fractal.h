@@ -0,0 +1,71 @@
+#ifndef FRACTAL_H
+#define FRACTAL_H
+
+#include <complex>
+#include <QColor>
+#include <QPointF>
+
+enum class formula_kind
+{
+    MANDELBROT,
+    MULTIBROT,
+    BURNING_SHIP
+};
+
+// Escape time colours a pixel by its own orbit, Buddhabrot by how many escaping
+// orbits pass through it
+enum class render_mode
+{
+    ESCAPE_TIME,
+    BUDDHABROT
+};
+
+struct frame_params
+{
+    int w, h, max_iter_num, max_color_num;
+    double zoom;
+    QPointF frame_center;
+    QColor color;
+    bool auto_iter = false;
+    bool prefetch = false;
+    int aa_samples = 0;
+    int aa_threshold = 1;
+    formula_kind formula = formula_kind::MANDELBROT;
+    int power = 2;
+    bool julia = false;
+    QPointF julia_c;
+    render_mode mode = render_mode::ESCAPE_TIME;
+};
+
+namespace fractal
+{
+    constexpr int MIN_POWER = 2;
+    constexpr int MAX_POWER = 8;
+
+    // One instantiation per formula, power and Julia flag, picked once per frame
+    // and handed to the row helpers, so the iteration loop never branches on the formula
+    struct kernel
+    {
+        int (*point)(const frame_params& params, double pos_x, double pos_y);
+        void (*row)(const frame_params& params, int y, int from_x, int to_x, int step, int* span);
+        // Writes the orbit of c as re, im pairs and returns its length if it escapes, 0 otherwise
+        int (*orbit)(double c_re, double c_im, int max_iter_num, double* trace);
+        // Same counts as row with step 1, plus the |z| the orbit stopped at
+        void (*detail)(const frame_params& params, int y, int from_x, int to_x, int* span, float* modulus);
+    };
+
+    kernel select_kernel(const frame_params& params);
+    bool is_mirrored(const frame_params& params);
+    std::complex<double> pixel_point(QPointF frame_center, double pos_x, double pos_y, int window_w, int window_h, double zoom);
+    double colour_value(int iter, int max_iter_num, int max_color_num);
+    void fill_row(const kernel& counter, const frame_params& params, int y, int step, int* iter_line, unsigned char* bit_line);
+    void count_row(const kernel& counter, const frame_params& params, int y, int from_x, int to_x, int* iter_line);
+    void count_span(const kernel& counter, const frame_params& params, int y, int from_x, int to_x, int* span);
+    void colour_row(const frame_params& params, const int* iter_line, unsigned char* bit_line);
+    void detail_row(const kernel& counter, const frame_params& params, int y, int* iter_line, float* modulus_line);
+    float smooth_value(const frame_params& params, int iter, float modulus);
+    int supersample_row(const kernel& counter, const frame_params& params, int y, const int* prev_line, const int* iter_line,
+                        const int* next_line, unsigned char* bit_line);
+}
+
+#endif // FRACTAL_H
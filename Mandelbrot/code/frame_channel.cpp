@@ -0,0 +1,130 @@
+#include "frame_channel.h"
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+Frame_channel::Frame_channel(QString name)
+    : name(name.startsWith("/") ? name : "/" + name)
+    , fd(-1)
+    , memory(nullptr)
+    , mapped_bytes(0)
+    , frames(0)
+{}
+
+Frame_channel::~Frame_channel()
+{
+#ifdef Q_OS_UNIX
+    if (memory)
+        munmap(memory, mapped_bytes);
+    if (fd >= 0)
+    {
+        close(fd);
+        shm_unlink(name.toLocal8Bit().constData());
+    }
+#endif
+}
+
+bool Frame_channel::open(QString& error)
+{
+#ifdef Q_OS_UNIX
+    fd = shm_open(name.toLocal8Bit().constData(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        error = QString("%1: %2").arg(name, std::strerror(errno));
+        return false;
+    }
+    if (!reserve(0))
+    {
+        error = QString("%1: %2").arg(name, std::strerror(errno));
+        return false;
+    }
+
+    header* h = head();
+    std::memcpy(h->magic, "MANDSHM1", sizeof(h->magic));
+    h->header_bytes = sizeof(header);
+    h->slot_count = SLOT_COUNT;
+    return true;
+#else
+    error = "Shared memory frames need a POSIX system";
+    return false;
+#endif
+}
+
+// Slots only ever grow, so a reader's old mapping stays valid while it remaps
+bool Frame_channel::reserve(quint64 frame_bytes)
+{
+#ifdef Q_OS_UNIX
+    const quint64 slot_bytes = sizeof(slot_header) + frame_bytes;
+    const quint64 total = sizeof(header) + SLOT_COUNT * slot_bytes;
+    if (memory && total <= mapped_bytes)
+        return true;
+
+    header* old_head = head();
+    quint64 layout = 0;
+    if (old_head)
+    {
+        layout = old_head->layout.load(std::memory_order_relaxed) + 1;
+        old_head->layout.store(layout, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        munmap(memory, mapped_bytes);
+        memory = nullptr;
+    }
+
+    if (ftruncate(fd, total) != 0)
+        return false;
+    void* mapped = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED)
+        return false;
+    memory = static_cast<unsigned char*>(mapped);
+    mapped_bytes = total;
+
+    // slot() addresses the slots through the new slot size
+    head()->slot_bytes = slot_bytes;
+    for (int i = 0; i < SLOT_COUNT; i++)
+        slot(i)->sequence.store(0, std::memory_order_relaxed);
+    head()->latest.store(0, std::memory_order_relaxed);
+    head()->layout.store(old_head ? layout + 1 : 0, std::memory_order_release);
+    return true;
+#else
+    return false;
+#endif
+}
+
+Frame_channel::header* Frame_channel::head() const
+{
+    return reinterpret_cast<header*>(memory);
+}
+
+Frame_channel::slot_header* Frame_channel::slot(int index) const
+{
+    return reinterpret_cast<slot_header*>(memory + sizeof(header) + index * head()->slot_bytes);
+}
+
+void Frame_channel::publish(const QImage& frame, const frame_params& params)
+{
+    const quint64 frame_bytes = static_cast<quint64>(frame.bytesPerLine()) * frame.height();
+    if (fd < 0 || frame.format() != QImage::Format_RGB888 || !reserve(frame_bytes))
+        return;
+
+    const quint64 sequence = ++frames;
+    slot_header* target = slot((sequence - 1) % SLOT_COUNT);
+    target->sequence.store(2 * sequence - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    target->width = frame.width();
+    target->height = frame.height();
+    target->bytes_per_line = frame.bytesPerLine();
+    target->format = FORMAT_RGB888;
+    target->center_x = params.frame_center.x();
+    target->center_y = params.frame_center.y();
+    target->zoom = params.zoom;
+    std::memcpy(reinterpret_cast<unsigned char*>(target) + sizeof(slot_header), frame.constBits(), frame_bytes);
+
+    target->sequence.store(2 * sequence, std::memory_order_release);
+    head()->latest.store(sequence, std::memory_order_release);
+}
@@ -0,0 +1,66 @@
+#ifndef FRAME_CHANNEL_H
+#define FRAME_CHANNEL_H
+
+#include <atomic>
+#include <QImage>
+#include <QString>
+#include "fractal.h"
+
+// Publishes finished frames into a POSIX shared memory object ("/name", see
+// shm_open) that any number of readers map read-only. The writer never waits
+// for readers: each frame goes into the next of SLOT_COUNT slots under a
+// per-slot sequence lock.
+//
+// Reader protocol:
+//   1. layout = header.layout; retry while it is odd, remap if the file grew.
+//   2. n = header.latest (0 means no frame yet), the frame is in slot (n - 1) % slot_count
+//      at offset header_bytes + slot * slot_bytes.
+//   3. s = slot.sequence; the slot holds frame n only if s == 2 * n.
+//   4. Read the pixels that follow the slot header in place, then check that
+//      slot.sequence and header.layout are unchanged; otherwise start over.
+class Frame_channel
+{
+public:
+    constexpr static int SLOT_COUNT = 4;
+    constexpr static quint32 FORMAT_RGB888 = 1;
+
+    struct header
+    {
+        char magic[8];
+        quint32 header_bytes;
+        quint32 slot_count;
+        std::atomic<quint64> layout;
+        quint64 slot_bytes;
+        std::atomic<quint64> latest;
+        char reserved[24];
+    };
+
+    struct slot_header
+    {
+        std::atomic<quint64> sequence;
+        quint32 width, height, bytes_per_line, format;
+        double center_x, center_y, zoom;
+        char reserved[16];
+    };
+
+    static_assert(sizeof(header) == 64 && sizeof(slot_header) == 64, "Shared layout must not change");
+    static_assert(std::atomic<quint64>::is_always_lock_free, "Sequence counters must be lock-free");
+
+    explicit Frame_channel(QString name);
+    ~Frame_channel();
+
+    bool open(QString& error);
+    void publish(const QImage& frame, const frame_params& params);
+private:
+    QString name;
+    int fd;
+    unsigned char* memory;
+    quint64 mapped_bytes;
+    quint64 frames;
+
+    bool reserve(quint64 frame_bytes);
+    header* head() const;
+    slot_header* slot(int index) const;
+};
+
+#endif // FRAME_CHANNEL_H
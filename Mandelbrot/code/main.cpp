@@ -1,11 +1,276 @@
+#include "animation_renderer.h"
 #include "mainwindow.h"
+#include "poster_renderer.h"
+#include "render_pool.h"
+#include "tile_pyramid.h"
+#include "tile_server.h"
+#include "tile_worker.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
 #include <QApplication>
+#include <QCommandLineParser>
+
+namespace
+{
+    bool is_headless(int argc, char* argv[])
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            if (std::strcmp(argv[i], "--poster") == 0 || std::strcmp(argv[i], "--iterations") == 0
+                || std::strcmp(argv[i], "--animation") == 0
+                || std::strcmp(argv[i], "--tile-worker") == 0 || std::strcmp(argv[i], "--tile-server") == 0
+                || std::strcmp(argv[i], "--pyramid") == 0)
+                return true;
+        }
+        return false;
+    }
+
+    bool parse_pair(const QString& text, QChar separator, double& first, double& second)
+    {
+        QStringList parts = text.split(separator);
+        if (parts.size() != 2)
+            return false;
+        bool ok_first = false, ok_second = false;
+        first = parts[0].toDouble(&ok_first);
+        second = parts[1].toDouble(&ok_second);
+        return ok_first && ok_second;
+    }
+}
 
 int main(int argc, char *argv[])
 {
-    QApplication a(argc, argv);
+    std::unique_ptr<QCoreApplication> a(is_headless(argc, argv) ? new QCoreApplication(argc, argv)
+                                                               : new QApplication(argc, argv));
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption threads_option("threads", "Number of render threads (default: one per physical core).", "count");
+    QCommandLineOption pin_option("pin", "Pin render threads to cores.");
+    QCommandLineOption smt_option("smt", "Use SMT siblings as separate render threads.");
+    QCommandLineOption poster_option("poster", "Render a poster to a PPM file ('-' for stdout) without a window.", "file");
+    QCommandLineOption size_option("size", "Poster size.", "WxH", "1920x1080");
+    QCommandLineOption center_option("center", "Frame center.", "x,y", "0,0");
+    QCommandLineOption zoom_option("zoom", "Size of one pixel on the complex plane (default: fit height 3).", "zoom");
+    QCommandLineOption iter_option("iter", "Maximum number of iterations.", "count", "100");
+    QCommandLineOption colours_option("colours", "Number of colour steps.", "count", "50");
+    QCommandLineOption colour_option("colour", "Base colour.", "#rrggbb", "#7f7fff");
+    QCommandLineOption workers_option("workers", "Count posters and animations on tile workers "
+                                      "(comma-separated \"host:port\" or \"unix:/path\").", "addresses");
+    QCommandLineOption tile_worker_option("tile-worker", "Serve tiles for other instances on \"host:port\" "
+                                          "or \"unix:/path\" without a window.", "address");
+    QCommandLineOption tile_server_option("tile-server", "Serve map tiles over HTTP as /z/x/y.png on \"host:port\" "
+                                          "(localhost when the host is left out) or \"unix:/path\".", "address");
+    QCommandLineOption tiles_option("tiles", "Prebuilt pyramid directory the tile server reads before rendering.", "dir");
+    QCommandLineOption cache_option("cache", "Memory for encoded tiles in the tile server.", "MB",
+                                    QString::number(Tile_server::DEFAULT_CACHE_MB));
+    QCommandLineOption pyramid_option("pyramid", "Write all map tiles down to the given level into the --output "
+                                      "directory, rendering only the deepest level.", "depth");
+    QCommandLineOption share_frames_option("share-frames", "Publish every frame of the window into the shared "
+                                           "memory object /name for other processes.", "name");
+    QCommandLineOption iterations_option("iterations", "Also write the raw escape counts of the poster as a NumPy "
+                                         ".npy array (the poster itself is optional then).", "file");
+    QCommandLineOption smooth_option("smooth", "With --iterations, add smooth escape counts as FILE_smooth.npy.");
+    QCommandLineOption modulus_option("modulus", "With --iterations, add the final |z| as FILE_modulus.npy.");
+    QCommandLineOption formula_option("formula", "Formula: mandelbrot, multibrot or burning-ship.", "name", "mandelbrot");
+    QCommandLineOption power_option("power", "Multibrot exponent (2-8).", "power", "3");
+    QCommandLineOption julia_option("julia", "Draw the Julia set for the constant c instead.", "re,im");
+    QCommandLineOption aa_option("aa", "Extra samples for pixels on escape-count edges (0 turns anti-aliasing off).",
+                                 "samples", "0");
+    QCommandLineOption aa_threshold_option("aa-threshold", "Escape-count difference with a neighbour that marks an edge.",
+                                           "count", "1");
+    QCommandLineOption band_option("band", "Rows rendered and kept in memory at once.", "rows", "64");
+    QCommandLineOption animation_option("animation", "Render a zoom animation along the keyframes in the file "
+                                        "(one \"x y zoom iterations\" per line).", "file");
+    QCommandLineOption output_option("output", "Animation output: '-' or a .y4m file for a raw video stream, "
+                                     "or an image name pattern with %1 for the frame number.", "path", "-");
+    QCommandLineOption frames_option("frames", "Frames between two keyframes.", "count", "60");
+    QCommandLineOption fps_option("fps", "Frame rate of the video stream.", "fps", "30");
+    QCommandLineOption no_seed_option("no-seed", "Count every animation frame in full instead of filling blocks "
+                                      "whose sampled border stays inside the set.");
+    parser.addOption(threads_option);
+    parser.addOption(pin_option);
+    parser.addOption(smt_option);
+    parser.addOption(poster_option);
+    parser.addOption(size_option);
+    parser.addOption(center_option);
+    parser.addOption(zoom_option);
+    parser.addOption(iter_option);
+    parser.addOption(colours_option);
+    parser.addOption(colour_option);
+    parser.addOption(workers_option);
+    parser.addOption(tile_worker_option);
+    parser.addOption(tile_server_option);
+    parser.addOption(tiles_option);
+    parser.addOption(cache_option);
+    parser.addOption(pyramid_option);
+    parser.addOption(share_frames_option);
+    parser.addOption(iterations_option);
+    parser.addOption(smooth_option);
+    parser.addOption(modulus_option);
+    parser.addOption(formula_option);
+    parser.addOption(power_option);
+    parser.addOption(julia_option);
+    parser.addOption(aa_option);
+    parser.addOption(aa_threshold_option);
+    parser.addOption(band_option);
+    parser.addOption(animation_option);
+    parser.addOption(output_option);
+    parser.addOption(frames_option);
+    parser.addOption(fps_option);
+    parser.addOption(no_seed_option);
+    parser.process(*a);
+
+    Render_pool::config pool_config;
+    pool_config.thread_count = parser.value(threads_option).toInt();
+    pool_config.pin_threads = parser.isSet(pin_option);
+    pool_config.use_smt = parser.isSet(smt_option);
+    Render_pool::configure(pool_config);
+
+    if (parser.isSet(tile_worker_option))
+    {
+        Tile_worker worker(parser.value(tile_worker_option));
+        worker.serve();
+        std::fprintf(stderr, "Can't serve tiles: %s\n", qPrintable(worker.error_string()));
+        return 1;
+    }
+
+    if (parser.isSet(poster_option) || parser.isSet(iterations_option) || parser.isSet(animation_option)
+        || parser.isSet(tile_server_option) || parser.isSet(pyramid_option))
+    {
+        double w = 0, h = 0, x = 0, y = 0;
+        if (!parse_pair(parser.value(size_option), 'x', w, h) || !parse_pair(parser.value(center_option), ',', x, y))
+        {
+            std::fprintf(stderr, "Bad --size or --center value\n");
+            return 1;
+        }
+
+        QStringList workers;
+        if (parser.isSet(workers_option))
+            workers = parser.value(workers_option).split(',');
+
+        frame_params params;
+        params.w = static_cast<int>(w);
+        params.h = static_cast<int>(h);
+        params.frame_center = QPointF(x, y);
+        params.zoom = parser.isSet(zoom_option) ? parser.value(zoom_option).toDouble() : 3.0 / h;
+        params.max_iter_num = std::max(parser.value(iter_option).toInt(), 1);
+        params.max_color_num = std::max(parser.value(colours_option).toInt(), 1);
+        params.color = QColor(parser.value(colour_option));
+        const QString formula = parser.value(formula_option);
+        if (formula == "multibrot")
+            params.formula = formula_kind::MULTIBROT;
+        else if (formula == "burning-ship")
+            params.formula = formula_kind::BURNING_SHIP;
+        else if (formula != "mandelbrot")
+        {
+            std::fprintf(stderr, "Unknown formula %s\n", qPrintable(formula));
+            return 1;
+        }
+        params.power = std::clamp(parser.value(power_option).toInt(), fractal::MIN_POWER, fractal::MAX_POWER);
+        if (parser.isSet(julia_option))
+        {
+            double re = 0, im = 0;
+            if (!parse_pair(parser.value(julia_option), ',', re, im))
+            {
+                std::fprintf(stderr, "Bad --julia value\n");
+                return 1;
+            }
+            params.julia = true;
+            params.julia_c = QPointF(re, im);
+        }
+        params.aa_samples = std::max(parser.value(aa_option).toInt(), 0);
+        params.aa_threshold = std::max(parser.value(aa_threshold_option).toInt(), 0);
+
+        if (parser.isSet(pyramid_option))
+        {
+            bool ok = false;
+            const int depth = parser.value(pyramid_option).toInt(&ok);
+            const QString dir = parser.value(output_option);
+            if (!ok || dir == "-")
+            {
+                std::fprintf(stderr, "--pyramid needs a depth and an --output directory\n");
+                return 1;
+            }
+            Tile_pyramid pyramid(params);
+            QString error;
+            if (!pyramid.build(depth, dir, error))
+            {
+                std::fprintf(stderr, "Pyramid rendering failed: %s\n", qPrintable(error));
+                return 1;
+            }
+            return 0;
+        }
+
+        if (parser.isSet(tile_server_option))
+        {
+            Tile_server server(parser.value(tile_server_option), params, parser.value(tiles_option),
+                               std::max(parser.value(cache_option).toInt(), 1));
+            server.serve();
+            std::fprintf(stderr, "Can't serve map tiles: %s\n", qPrintable(server.error_string()));
+            return 1;
+        }
+
+        if (parser.isSet(animation_option))
+        {
+            Animation_renderer::settings animation;
+            animation.params = params;
+            animation.frames_per_segment = parser.value(frames_option).toInt();
+            animation.fps = parser.value(fps_option).toInt();
+            animation.path = parser.value(output_option);
+            animation.workers = workers;
+            animation.seed = !parser.isSet(no_seed_option);
+            QString error;
+            if (!Animation_renderer::load_keyframes(parser.value(animation_option), animation.keyframes, error))
+            {
+                std::fprintf(stderr, "Can't read keyframes: %s\n", qPrintable(error));
+                return 1;
+            }
+
+            Animation_renderer renderer(animation);
+            if (!renderer.render())
+            {
+                std::fprintf(stderr, "Animation rendering failed: %s\n", qPrintable(renderer.error_string()));
+                return 1;
+            }
+            return 0;
+        }
+
+        Poster_renderer::settings poster;
+        poster.params = params;
+        poster.band_h = parser.value(band_option).toInt();
+        poster.path = parser.value(poster_option);
+        poster.workers = workers;
+        poster.field_path = parser.value(iterations_option);
+        poster.smooth = parser.isSet(smooth_option);
+        poster.modulus = parser.isSet(modulus_option);
+
+        Poster_renderer renderer(poster);
+        if (!renderer.render())
+        {
+            std::fprintf(stderr, "Poster rendering failed: %s\n", qPrintable(renderer.error_string()));
+            return 1;
+        }
+        if (params.aa_samples > 0)
+        {
+            std::fprintf(stderr, "Anti-aliasing refined %.1f%% of pixels\n",
+                         100.0 * renderer.refined_pixels() / (static_cast<double>(params.w) * params.h));
+        }
+        return 0;
+    }
+
     MainWindow w;
+    if (parser.isSet(share_frames_option))
+    {
+        QString error;
+        if (!w.share_frames(parser.value(share_frames_option), error))
+        {
+            std::fprintf(stderr, "Can't share frames: %s\n", qPrintable(error));
+            return 1;
+        }
+    }
     w.show();
-    return a.exec();
+    return a->exec();
 }
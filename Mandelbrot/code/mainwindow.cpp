@@ -1,6 +1,8 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
+#include "drawspace.h"
 #include <QColorDialog>
+#include <QFileDialog>
 #include <memory>
 
 MainWindow::MainWindow(QWidget *parent)
@@ -12,6 +14,12 @@ MainWindow::MainWindow(QWidget *parent)
     resize(800, 600);
     ui->colour_box->setValue(ui->space->get_colour_num());
     ui->iter_box->setValue(ui->space->get_iter_num());
+    ui->auto_iter_box->setChecked(ui->space->get_auto_iter());
+    ui->aa_box->setChecked(ui->space->get_antialiasing());
+    ui->prefetch_box->setChecked(ui->space->get_prefetch());
+    show_formula();
+    connect(ui->space, &drawspace::iter_num_changed, this, &MainWindow::update_iter_num);
+    connect(ui->space, &drawspace::supersampled, this, &MainWindow::show_supersampled);
 }
 
 void MainWindow::choose_colour()
@@ -31,6 +39,12 @@ void MainWindow::set_settings()
 
     ui->space->set_iter_num(new_iter);
     ui->space->set_colour_num(new_colour);
+    ui->space->set_auto_iter(ui->auto_iter_box->isChecked());
+    ui->space->set_antialiasing(ui->aa_box->isChecked());
+    ui->space->set_prefetch(ui->prefetch_box->isChecked());
+    ui->space->set_formula(static_cast<formula_kind>(ui->formula_box->currentIndex()), ui->power_box->value());
+    ui->space->set_julia(ui->julia_box->isChecked(), QPointF(ui->julia_re_box->value(), ui->julia_im_box->value()));
+    ui->space->set_mode(static_cast<render_mode>(ui->mode_box->currentIndex()));
     ui->space->call_repaint();
 }
 
@@ -39,6 +53,10 @@ void MainWindow::reset_settings()
     ui->space->reset_nums();
     ui->colour_box->setValue(ui->space->get_colour_num());
     ui->iter_box->setValue(ui->space->get_iter_num());
+    ui->auto_iter_box->setChecked(ui->space->get_auto_iter());
+    ui->aa_box->setChecked(ui->space->get_antialiasing());
+    ui->prefetch_box->setChecked(ui->space->get_prefetch());
+    show_formula();
     ui->space->call_repaint();
 }
 
@@ -47,6 +65,71 @@ void MainWindow::reset()
     ui->space->reset();
     ui->colour_box->setValue(ui->space->get_colour_num());
     ui->iter_box->setValue(ui->space->get_iter_num());
+    ui->auto_iter_box->setChecked(ui->space->get_auto_iter());
+    ui->aa_box->setChecked(ui->space->get_antialiasing());
+    ui->prefetch_box->setChecked(ui->space->get_prefetch());
+    show_formula();
+}
+
+void MainWindow::update_iter_num(int iter_num)
+{
+    ui->iter_box->setValue(iter_num);
+}
+
+void MainWindow::show_supersampled(double refined_fraction)
+{
+    statusBar()->showMessage(QString("Anti-aliasing refined %1% of pixels").arg(refined_fraction * 100, 0, 'f', 1));
+}
+
+// The current view at EXPORT_SCALE times the window size
+void MainWindow::export_poster()
+{
+    if (export_job && export_job->isRunning())
+    {
+        statusBar()->showMessage("An export is already running");
+        return;
+    }
+
+    QString path = QFileDialog::getSaveFileName(this, "Export poster", QString(), "PPM images (*.ppm)");
+    if (path.isEmpty())
+        return;
+
+    Poster_renderer::settings poster;
+    poster.params = ui->space->current_params();
+    poster.params.w *= EXPORT_SCALE;
+    poster.params.h *= EXPORT_SCALE;
+    poster.params.zoom /= EXPORT_SCALE;
+    poster.band_h = EXPORT_BAND;
+    poster.path = path;
+    poster.priority = Render_pool::priority::BACKGROUND;
+
+    export_job.reset(new Export_job(poster));
+    connect(export_job.get(), &QThread::finished, this, &MainWindow::export_finished);
+    export_job->start();
+    statusBar()->showMessage(QString("Exporting to %1...").arg(path));
+}
+
+void MainWindow::export_finished()
+{
+    if (export_job->succeeded())
+        statusBar()->showMessage(QString("Exported to %1").arg(export_job->path()));
+    else
+        statusBar()->showMessage(QString("Export failed: %1").arg(export_job->error_string()));
+}
+
+void MainWindow::show_formula()
+{
+    ui->formula_box->setCurrentIndex(static_cast<int>(ui->space->get_formula()));
+    ui->power_box->setValue(ui->space->get_power());
+    ui->julia_box->setChecked(ui->space->get_julia());
+    ui->julia_re_box->setValue(ui->space->get_julia_c().x());
+    ui->julia_im_box->setValue(ui->space->get_julia_c().y());
+    ui->mode_box->setCurrentIndex(static_cast<int>(ui->space->get_mode()));
+}
+
+bool MainWindow::share_frames(const QString& name, QString& error)
+{
+    return ui->space->share_frames(name, error);
 }
 
 MainWindow::~MainWindow()
@@ -5,6 +5,7 @@
 #include <QMainWindow>
 #include <QPainter>
 #include <memory>
+#include "export_job.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
@@ -18,12 +19,24 @@ public:
     MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
+    bool share_frames(const QString& name, QString& error);
+
 public slots:
     void choose_colour();
     void set_settings();
     void reset();
     void reset_settings();
+    void update_iter_num(int iter_num);
+    void show_supersampled(double refined_fraction);
+    void export_poster();
+    void export_finished();
 private:
+    constexpr static int EXPORT_SCALE = 4;
+    constexpr static int EXPORT_BAND = 64;
+
+    void show_formula();
+
     std::unique_ptr<Ui::MainWindow> ui;
+    std::unique_ptr<Export_job> export_job;
 };
 #endif // MAINWINDOW_H
@@ -0,0 +1,83 @@
+#include "npy_writer.h"
+#include <QtEndian>
+
+Npy_writer::Npy_writer(QString path, QString descr, int item_size, int w, int h)
+    : path(path)
+    , descr(descr)
+    , item_size(item_size)
+    , w(w)
+    , h(h)
+    , written_rows(0)
+    , out(path)
+{}
+
+// Format version 1.0: magic, version, header length and a Python dict literal
+// padded with spaces up to the alignment and ended by a newline
+bool Npy_writer::open()
+{
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        error = QString("%1: %2").arg(path, out.errorString());
+        return false;
+    }
+
+    const QString order = (Q_BYTE_ORDER == Q_LITTLE_ENDIAN) ? "<" : ">";
+    QByteArray dict = QString("{'descr': '%1%2', 'fortran_order': False, 'shape': (%3, %4), }")
+                          .arg(order, descr).arg(h).arg(w).toLatin1();
+    const int prefix = 10;
+    const int padded = (prefix + dict.size() + 1 + HEADER_ALIGN - 1) / HEADER_ALIGN * HEADER_ALIGN;
+    dict.append(QByteArray(padded - prefix - dict.size() - 1, ' '));
+    dict.append('\n');
+
+    QByteArray header("\x93NUMPY\x01\x00", 8);
+    const quint16 length = qToLittleEndian(static_cast<quint16>(dict.size()));
+    header.append(reinterpret_cast<const char*>(&length), sizeof(length));
+    header.append(dict);
+    if (out.write(header) != header.size())
+    {
+        error = QString("%1: %2").arg(path, out.errorString());
+        return false;
+    }
+    return true;
+}
+
+bool Npy_writer::write_rows(const void* data, int rows)
+{
+    const qint64 size = static_cast<qint64>(rows) * w * item_size;
+    if (out.write(static_cast<const char*>(data), size) != size)
+    {
+        error = QString("%1: %2").arg(path, out.errorString());
+        return false;
+    }
+    written_rows += rows;
+    return true;
+}
+
+bool Npy_writer::finish()
+{
+    if (written_rows != h)
+    {
+        error = QString("%1: %2 of %3 rows written").arg(path).arg(written_rows).arg(h);
+        out.close();
+        return false;
+    }
+    if (!out.flush())
+    {
+        error = QString("%1: %2").arg(path, out.errorString());
+        return false;
+    }
+    out.close();
+    return true;
+}
+
+QString Npy_writer::error_string() const
+{
+    return error;
+}
+
+// "field.npy" with suffix "smooth" becomes "field_smooth.npy"
+QString Npy_writer::sibling(const QString& path, const QString& suffix)
+{
+    const QString base = path.endsWith(".npy") ? path.left(path.size() - 4) : path;
+    return QString("%1_%2.npy").arg(base, suffix);
+}
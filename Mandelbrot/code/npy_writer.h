@@ -0,0 +1,33 @@
+#ifndef NPY_WRITER_H
+#define NPY_WRITER_H
+
+#include <QFile>
+#include <QString>
+
+// Streams a two-dimensional array in host byte order into a NumPy .npy file
+// row block by row block. The header is padded to HEADER_ALIGN bytes, so the data
+// can be mapped straight away, e.g. numpy.load(path, mmap_mode='r').
+class Npy_writer
+{
+public:
+    constexpr static int HEADER_ALIGN = 64;
+
+    Npy_writer(QString path, QString descr, int item_size, int w, int h);
+
+    bool open();
+    bool write_rows(const void* data, int rows);
+    bool finish();
+    QString error_string() const;
+
+    static QString sibling(const QString& path, const QString& suffix);
+private:
+    QString path;
+    QString descr;
+    int item_size;
+    int w, h;
+    int written_rows;
+    QFile out;
+    QString error;
+};
+
+#endif // NPY_WRITER_H
@@ -0,0 +1,343 @@
+#include "poster_renderer.h"
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <QThread>
+
+class Poster_renderer::Band_writer : public QThread
+{
+public:
+    explicit Band_writer(Poster_renderer* owner)
+        : owner(owner)
+    {}
+
+    virtual void run() override
+    {
+        owner->write_loop();
+    }
+private:
+    Poster_renderer* owner;
+};
+
+Poster_renderer::Poster_renderer(settings cfg)
+    : cfg(cfg)
+    , halo(0)
+    , free_bands(BAND_BUFFERS)
+    , filled_bands(0)
+    , write_failed(false)
+    , produced_bands(0)
+    , refined(0)
+    , cancelled(false)
+{
+    if (this->cfg.band_h < 1)
+        this->cfg.band_h = 1;
+}
+
+Poster_renderer::~Poster_renderer()
+{
+    for (Npy_writer* field : fields)
+        delete field;
+}
+
+QString Poster_renderer::error_string() const
+{
+    return error;
+}
+
+// Stops after the bands already in flight, the file is left incomplete
+void Poster_renderer::cancel()
+{
+    cancelled = true;
+}
+
+long long Poster_renderer::refined_pixels() const
+{
+    return refined;
+}
+
+// Bands are computed on the render pool while the writer thread streams the
+// previous ones to disk, so memory stays at BAND_BUFFERS bands whatever the size.
+bool Poster_renderer::render()
+{
+    const frame_params& params = cfg.params;
+    if (params.w < 1 || params.h < 1)
+    {
+        error = "Empty poster size";
+        return false;
+    }
+
+    if (!cfg.path.isEmpty())
+    {
+        if (cfg.path != "-")
+            out.setFileName(cfg.path);
+        bool opened = (cfg.path == "-") ? out.open(stdout, QIODevice::WriteOnly)
+                                        : out.open(QIODevice::WriteOnly | QIODevice::Truncate);
+        if (!opened)
+        {
+            error = out.errorString();
+            return false;
+        }
+        QByteArray header = QString("P6\n%1 %2\n255\n").arg(params.w).arg(params.h).toLatin1();
+        if (out.write(header) != header.size())
+        {
+            error = out.errorString();
+            return false;
+        }
+    }
+    if (!open_fields())
+        return false;
+
+    // Anti-aliasing compares every pixel with its vertical neighbours, so each
+    // band also counts one row above and below itself
+    halo = (params.aa_samples > 0) ? 1 : 0;
+    counter = fractal::select_kernel(params);
+    // QVector sizes are int, so both band buffers have to stay below INT_MAX
+    // elements: the RGB one holds 3 bytes per pixel of the band itself, the
+    // iteration one an int per pixel of the band and its halo rows. Larger
+    // --band values are clamped
+    const int max_band_h = std::min(std::numeric_limits<int>::max() / 3 / params.w,
+                                    std::numeric_limits<int>::max() / params.w - 2 * halo);
+    if (max_band_h < 1)
+    {
+        error = "Poster is too wide";
+        return false;
+    }
+    const int band_h = std::min({cfg.band_h, params.h, max_band_h});
+    const int band_count = (params.h + band_h - 1) / band_h;
+    bands.resize(BAND_BUFFERS);
+    for (band& buffer : bands)
+    {
+        buffer.rgb.resize(params.w * band_h * 3);
+        buffer.iters.resize(params.w * (band_h + 2 * halo));
+        if (needs_modulus())
+            buffer.modulus.resize(params.w * band_h);
+        if (cfg.smooth)
+            buffer.smooth.resize(params.w * band_h);
+    }
+
+    // Tile workers only send escape counts back
+    if (!cfg.workers.isEmpty() && !needs_modulus())
+        coordinator.reset(new Tile_coordinator(cfg.workers));
+
+    Band_writer writer(this);
+    writer.start();
+
+    QVector<std::shared_ptr<Render_batch>> in_flight;
+    for (int b = 0; b < band_count && !write_failed && !cancelled; b++)
+    {
+        free_bands.acquire();
+        band& buffer = bands[b % BAND_BUFFERS];
+        buffer.from_h = b * band_h;
+        buffer.to_h = std::min(buffer.from_h + band_h, params.h);
+        if (coordinator)
+        {
+            if (!render_remote(buffer))
+                break;
+            finish_band(nullptr, buffer);
+            continue;
+        }
+        in_flight.append(submit_rows(buffer, std::max(buffer.from_h - halo, 0),
+                                     std::min(buffer.to_h + halo, params.h), false));
+
+        if (in_flight.size() == BANDS_IN_FLIGHT)
+        {
+            finish_band(in_flight.front(), bands[produced_bands % BAND_BUFFERS]);
+            in_flight.pop_front();
+        }
+    }
+    while (!in_flight.isEmpty())
+    {
+        finish_band(in_flight.front(), bands[produced_bands % BAND_BUFFERS]);
+        in_flight.pop_front();
+    }
+    // One extra token tells the writer that no more bands will come
+    filled_bands.release();
+    writer.wait();
+
+    if (cancelled && !write_failed)
+    {
+        error = "Cancelled";
+        write_failed = true;
+    }
+    if (!write_failed && out.isOpen() && !out.flush())
+        write_failed = true;
+    if (write_failed && error.isEmpty())
+        error = out.errorString();
+    out.close();
+    for (Npy_writer* field : fields)
+    {
+        if (!write_failed && !field->finish())
+        {
+            error = field->error_string();
+            write_failed = true;
+        }
+    }
+    return !write_failed;
+}
+
+std::shared_ptr<Render_batch> Poster_renderer::submit_rows(band& buffer, int from_h, int to_h, bool supersample)
+{
+    Render_pool& pool = Render_pool::instance();
+    const int rows = to_h - from_h;
+    const int task_count = std::min(rows, pool.thread_count() * TASKS_PER_THREAD);
+    const int rows_per_task = (rows + task_count - 1) / task_count;
+    return pool.submit(task_count, [this, &buffer, from_h, to_h, rows_per_task, supersample](int i)
+                       {
+                           int task_from = from_h + i * rows_per_task;
+                           int task_to = std::min(task_from + rows_per_task, to_h);
+                           if (supersample)
+                               supersample_rows(buffer, task_from, task_to);
+                           else
+                               render_rows(buffer, task_from, task_to);
+                       }, cfg.priority);
+}
+
+// Halo rows only need their iterations, they are coloured with their own band
+void Poster_renderer::render_rows(band& buffer, int from_h, int to_h)
+{
+    const int w = cfg.params.w;
+    for (int y = from_h; y < to_h; y++)
+    {
+        const int row = y - buffer.from_h;
+        int* iter_line = buffer.iters.data() + (row + halo) * w;
+        if (y < buffer.from_h || y >= buffer.to_h)
+        {
+            fractal::count_row(counter, cfg.params, y, 0, w, iter_line);
+        }
+        else if (needs_modulus())
+        {
+            float* modulus_line = buffer.modulus.data() + row * w;
+            fractal::detail_row(counter, cfg.params, y, iter_line, modulus_line);
+            fractal::colour_row(cfg.params, iter_line, buffer.rgb.data() + row * w * 3);
+            if (cfg.smooth)
+            {
+                float* smooth_line = buffer.smooth.data() + row * w;
+                for (int x = 0; x < w; x++)
+                    smooth_line[x] = fractal::smooth_value(cfg.params, iter_line[x], modulus_line[x]);
+            }
+        }
+        else
+        {
+            fractal::fill_row(counter, cfg.params, y, 1, iter_line, buffer.rgb.data() + row * w * 3);
+        }
+    }
+}
+
+void Poster_renderer::supersample_rows(band& buffer, int from_h, int to_h)
+{
+    const int w = cfg.params.w, h = cfg.params.h;
+    int band_refined = 0;
+    for (int y = from_h; y < to_h; y++)
+    {
+        const int row = y - buffer.from_h;
+        const int* iter_line = buffer.iters.constData() + (row + halo) * w;
+        band_refined += fractal::supersample_row(counter, cfg.params, y, y > 0 ? iter_line - w : nullptr, iter_line,
+                                                 y + 1 < h ? iter_line + w : nullptr, buffer.rgb.data() + row * w * 3);
+    }
+    refined += band_refined;
+}
+
+// Iterations come from the tile workers, colouring and the edge pass stay local
+bool Poster_renderer::render_remote(band& buffer)
+{
+    const int w = cfg.params.w;
+    const int from_h = std::max(buffer.from_h - halo, 0);
+    const int to_h = std::min(buffer.to_h + halo, cfg.params.h);
+    if (!coordinator->render(cfg.params, from_h, to_h, buffer.iters.data() + (from_h - buffer.from_h + halo) * w))
+    {
+        error = coordinator->error_string();
+        write_failed = true;
+        return false;
+    }
+
+    for (int y = buffer.from_h; y < buffer.to_h; y++)
+    {
+        const int row = y - buffer.from_h;
+        fractal::colour_row(cfg.params, buffer.iters.constData() + (row + halo) * w, buffer.rgb.data() + row * w * 3);
+    }
+    return true;
+}
+
+// The edge pass needs the whole band and its halo counted, so it runs as a
+// second batch once the first one is done
+void Poster_renderer::finish_band(std::shared_ptr<Render_batch> batch, band& buffer)
+{
+    if (batch)
+        batch->wait();
+    if (halo > 0)
+        submit_rows(buffer, buffer.from_h, buffer.to_h, true)->wait();
+    produced_bands++;
+    filled_bands.release();
+}
+
+bool Poster_renderer::needs_modulus() const
+{
+    return !cfg.field_path.isEmpty() && (cfg.smooth || cfg.modulus);
+}
+
+bool Poster_renderer::open_fields()
+{
+    if (cfg.field_path.isEmpty())
+        return true;
+
+    const int w = cfg.params.w, h = cfg.params.h;
+    fields.append(new Npy_writer(cfg.field_path, "i4", sizeof(int), w, h));
+    if (cfg.smooth)
+        fields.append(new Npy_writer(Npy_writer::sibling(cfg.field_path, "smooth"), "f4", sizeof(float), w, h));
+    if (cfg.modulus)
+        fields.append(new Npy_writer(Npy_writer::sibling(cfg.field_path, "modulus"), "f4", sizeof(float), w, h));
+    for (Npy_writer* field : fields)
+    {
+        if (!field->open())
+        {
+            error = field->error_string();
+            return false;
+        }
+    }
+    return true;
+}
+
+// Fields are written in the order open_fields created them
+bool Poster_renderer::write_fields(const band& buffer)
+{
+    if (fields.isEmpty())
+        return true;
+
+    const int w = cfg.params.w;
+    const int rows = buffer.to_h - buffer.from_h;
+    QVector<const void*> data{buffer.iters.constData() + halo * w};
+    if (cfg.smooth)
+        data.append(buffer.smooth.constData());
+    if (cfg.modulus)
+        data.append(buffer.modulus.constData());
+    for (int i = 0; i < fields.size(); i++)
+    {
+        if (!fields[i]->write_rows(data[i], rows))
+        {
+            error = fields[i]->error_string();
+            return false;
+        }
+    }
+    return true;
+}
+
+void Poster_renderer::write_loop()
+{
+    for (int b = 0;; b++)
+    {
+        filled_bands.acquire();
+        if (b == produced_bands)
+            return;
+
+        const band& buffer = bands[b % BAND_BUFFERS];
+        if (!write_failed && out.isOpen())
+        {
+            qint64 size = static_cast<qint64>(buffer.to_h - buffer.from_h) * cfg.params.w * 3;
+            if (out.write(reinterpret_cast<const char*>(buffer.rgb.constData()), size) != size)
+                write_failed = true;
+        }
+        if (!write_failed && !write_fields(buffer))
+            write_failed = true;
+        free_bands.release();
+    }
+}
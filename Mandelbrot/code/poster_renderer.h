@@ -0,0 +1,80 @@
+#ifndef POSTER_RENDERER_H
+#define POSTER_RENDERER_H
+
+#include <atomic>
+#include <memory>
+#include <QFile>
+#include <QSemaphore>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include "fractal.h"
+#include "npy_writer.h"
+#include "render_pool.h"
+#include "tile_coordinator.h"
+
+class Poster_renderer
+{
+    class Band_writer;
+public:
+    struct settings
+    {
+        frame_params params;
+        int band_h;
+        QString path;
+        QStringList workers;
+        Render_pool::priority priority = Render_pool::priority::INTERACTIVE;
+        // Raw escape counts go to field_path, smooth counts and the final |z|
+        // to its "_smooth" and "_modulus" siblings; an empty path skips the image
+        QString field_path;
+        bool smooth = false;
+        bool modulus = false;
+    };
+
+    explicit Poster_renderer(settings cfg);
+    ~Poster_renderer();
+
+    bool render();
+    void cancel();
+    QString error_string() const;
+    long long refined_pixels() const;
+private:
+    struct band
+    {
+        int from_h, to_h;
+        QVector<unsigned char> rgb;
+        QVector<int> iters;
+        QVector<float> smooth;
+        QVector<float> modulus;
+    };
+
+    constexpr static int BAND_BUFFERS = 3;
+    constexpr static int BANDS_IN_FLIGHT = 2;
+    constexpr static int TASKS_PER_THREAD = 4;
+    settings cfg;
+    QFile out;
+    QString error;
+    int halo;
+    fractal::kernel counter;
+    QVector<band> bands;
+    QSemaphore free_bands;
+    QSemaphore filled_bands;
+    std::atomic_bool write_failed;
+    std::atomic_int produced_bands;
+    std::atomic<long long> refined;
+    std::atomic_bool cancelled;
+    std::unique_ptr<Tile_coordinator> coordinator;
+    QVector<Npy_writer*> fields;
+
+    std::shared_ptr<Render_batch> submit_rows(band& buffer, int from_h, int to_h, bool supersample);
+    void render_rows(band& buffer, int from_h, int to_h);
+    void supersample_rows(band& buffer, int from_h, int to_h);
+    bool render_remote(band& buffer);
+    void finish_band(std::shared_ptr<Render_batch> batch, band& buffer);
+    bool needs_modulus() const;
+    bool open_fields();
+    bool write_fields(const band& buffer);
+    void write_loop();
+};
+
+#endif // POSTER_RENDERER_H
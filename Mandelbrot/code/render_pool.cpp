@@ -0,0 +1,244 @@
+#include "render_pool.h"
+#include <map>
+#include <utility>
+#include <QFile>
+
+#ifdef Q_OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+class Render_pool::Worker : public QThread
+{
+public:
+    Worker(Render_pool* pool, int index)
+        : pool(pool)
+        , index(index)
+    {}
+
+    virtual void run() override
+    {
+        pool->worker_loop(index);
+    }
+private:
+    Render_pool* pool;
+    int index;
+};
+
+Render_batch::Render_batch(int task_count, std::function<void(int)> task)
+    : task_count(task_count)
+    , next_task(0)
+    , done_tasks(0)
+    , cancelled(false)
+    , task(std::move(task))
+{}
+
+void Render_batch::cancel()
+{
+    cancelled = true;
+}
+
+bool Render_batch::is_cancelled() const
+{
+    return cancelled;
+}
+
+void Render_batch::wait()
+{
+    QMutexLocker lock(&m);
+    while (done_tasks != task_count)
+        finished_cond.wait(&m);
+}
+
+bool Render_batch::is_finished()
+{
+    QMutexLocker lock(&m);
+    return done_tasks == task_count;
+}
+
+void Render_batch::task_done()
+{
+    QMutexLocker lock(&m);
+    if (++done_tasks == task_count)
+        finished_cond.wakeAll();
+}
+
+namespace
+{
+    Render_pool::config& global_config()
+    {
+        static Render_pool::config cfg;
+        return cfg;
+    }
+}
+
+Render_pool::Render_pool(config cfg)
+    : stopping(false)
+{
+    int physical_cores = 0;
+    QVector<int> cpu_order = detect_cpu_order(physical_cores);
+
+    int th_count = cfg.thread_count;
+    if (th_count < 1)
+        th_count = (cfg.use_smt && !cpu_order.isEmpty()) ? cpu_order.size() : physical_cores;
+    if (th_count < 1)
+        th_count = 1;
+
+    for (int i = 0; i < th_count; i++)
+    {
+        if (cfg.pin_threads && !cpu_order.isEmpty())
+            pinned_cpus.append(cpu_order[i % cpu_order.size()]);
+        workers.append(new Worker(this, i));
+    }
+    for (Worker* worker : workers)
+        worker->start();
+}
+
+Render_pool::~Render_pool()
+{
+    {
+        QMutexLocker lock(&m);
+        stopping = true;
+        for (auto& queue : queues)
+        {
+            for (auto& batch : queue)
+                batch->cancel();
+        }
+        work_cond.wakeAll();
+    }
+
+    for (Worker* worker : workers)
+    {
+        worker->wait();
+        delete worker;
+    }
+}
+
+void Render_pool::configure(config cfg)
+{
+    global_config() = cfg;
+}
+
+Render_pool& Render_pool::instance()
+{
+    static Render_pool pool(global_config());
+    return pool;
+}
+
+int Render_pool::thread_count() const
+{
+    return workers.size();
+}
+
+std::shared_ptr<Render_batch> Render_pool::submit(int task_count, std::function<void(int)> task, priority prio)
+{
+    auto batch = std::make_shared<Render_batch>(task_count, std::move(task));
+    if (task_count <= 0)
+        return batch;
+
+    QMutexLocker lock(&m);
+    queues[static_cast<int>(prio)].append(batch);
+    work_cond.wakeAll();
+    return batch;
+}
+
+void Render_pool::worker_loop(int index)
+{
+    if (index < pinned_cpus.size())
+        pin_current_thread(pinned_cpus[index]);
+
+    forever
+    {
+        std::shared_ptr<Render_batch> batch;
+        int task_id;
+        {
+            QMutexLocker lock(&m);
+            QVector<std::shared_ptr<Render_batch>>* queue = nullptr;
+            forever
+            {
+                for (auto& candidate : queues)
+                {
+                    if (!candidate.isEmpty())
+                    {
+                        queue = &candidate;
+                        break;
+                    }
+                }
+                if (queue || stopping)
+                    break;
+                work_cond.wait(&m);
+            }
+            if (!queue)
+                return;
+
+            batch = queue->front();
+            task_id = batch->next_task++;
+            if (batch->next_task == batch->task_count)
+                queue->pop_front();
+        }
+
+        if (!batch->is_cancelled())
+            batch->task(task_id);
+        batch->task_done();
+    }
+}
+
+QVector<int> Render_pool::detect_cpu_order(int& physical_cores)
+{
+    QVector<int> order;
+#ifdef Q_OS_LINUX
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    {
+        auto read_id = [](int cpu, const char* name)
+        {
+            QFile file(QString("/sys/devices/system/cpu/cpu%1/topology/%2").arg(cpu).arg(name));
+            if (!file.open(QIODevice::ReadOnly))
+                return -1;
+            bool ok = false;
+            int id = file.readAll().trimmed().toInt(&ok);
+            return ok ? id : -1;
+        };
+
+        // (package, core) -> logical cpus sharing that physical core
+        std::map<std::pair<int, int>, QVector<int>> cores;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (!CPU_ISSET(cpu, &allowed))
+                continue;
+            int package = read_id(cpu, "physical_package_id");
+            int core = read_id(cpu, "core_id");
+            if (core < 0)
+                core = cpu;
+            cores[{package, core}].append(cpu);
+        }
+
+        // First one logical cpu of every physical core, then their SMT siblings
+        for (int sibling = 0; order.size() < CPU_COUNT(&allowed); sibling++)
+        {
+            for (const auto& core : cores)
+            {
+                if (sibling < core.second.size())
+                    order.append(core.second[sibling]);
+            }
+        }
+        physical_cores = static_cast<int>(cores.size());
+    }
+#endif
+    if (order.isEmpty())
+        physical_cores = QThread::idealThreadCount();
+    return order;
+}
+
+void Render_pool::pin_current_thread(int cpu)
+{
+#ifdef Q_OS_LINUX
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    Q_UNUSED(cpu);
+#endif
+}
@@ -0,0 +1,77 @@
+#ifndef RENDER_POOL_H
+#define RENDER_POOL_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+
+class Render_batch
+{
+    friend class Render_pool;
+public:
+    Render_batch(int task_count, std::function<void(int)> task);
+
+    void cancel();
+    void wait();
+    bool is_finished();
+    bool is_cancelled() const;
+private:
+    const int task_count;
+    int next_task;
+    int done_tasks;
+    std::atomic_bool cancelled;
+    std::function<void(int)> task;
+    QMutex m;
+    QWaitCondition finished_cond;
+
+    void task_done();
+};
+
+class Render_pool
+{
+    class Worker;
+public:
+    // Workers always take the next task of the most urgent queued batch, so a new
+    // interactive frame overtakes background work at the next task boundary
+    enum class priority
+    {
+        INTERACTIVE,
+        BACKGROUND,
+        PREFETCH
+    };
+
+    struct config
+    {
+        int thread_count = 0;
+        bool pin_threads = false;
+        bool use_smt = false;
+    };
+
+    explicit Render_pool(config cfg);
+    ~Render_pool();
+
+    static void configure(config cfg);
+    static Render_pool& instance();
+
+    int thread_count() const;
+    std::shared_ptr<Render_batch> submit(int task_count, std::function<void(int)> task,
+                                         priority prio = priority::INTERACTIVE);
+private:
+    constexpr static int PRIORITY_COUNT = 3;
+    QVector<Worker*> workers;
+    QVector<int> pinned_cpus;
+    QVector<std::shared_ptr<Render_batch>> queues[PRIORITY_COUNT];
+    QMutex m;
+    QWaitCondition work_cond;
+    bool stopping;
+
+    void worker_loop(int index);
+    static QVector<int> detect_cpu_order(int& physical_cores);
+    static void pin_current_thread(int cpu);
+};
+
+#endif // RENDER_POOL_H
@@ -0,0 +1,126 @@
+#include "tile_cache.h"
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+    qint64 floor_div(qint64 a, qint64 b)
+    {
+        return (a >= 0) ? a / b : -((-a + b - 1) / b);
+    }
+
+    void split_origin(double origin, qint64& whole, qint64& phase)
+    {
+        const double floor_part = std::floor(origin);
+        const qint64 steps = std::llround(1 / Tile_cache::PHASE_STEP);
+        whole = static_cast<qint64>(floor_part);
+        phase = std::llround((origin - floor_part) / Tile_cache::PHASE_STEP);
+        if (phase == steps)
+        {
+            phase = 0;
+            whole++;
+        }
+    }
+}
+
+bool tile_key::operator==(const tile_key& other) const
+{
+    return zoom == other.zoom && phase_x == other.phase_x && phase_y == other.phase_y
+        && max_iter_num == other.max_iter_num && formula == other.formula && power == other.power
+        && julia == other.julia && julia_re == other.julia_re && julia_im == other.julia_im
+        && x == other.x && y == other.y;
+}
+
+size_t qHash(const tile_key& key, size_t seed)
+{
+    size_t h = seed;
+    auto mix = [&h](quint64 value)
+    {
+        h ^= value + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+    };
+    quint64 zoom_bits = 0;
+    std::memcpy(&zoom_bits, &key.zoom, sizeof(zoom_bits));
+    mix(zoom_bits);
+    mix(key.phase_x);
+    mix(key.phase_y);
+    mix(key.max_iter_num);
+    mix(static_cast<quint64>(key.formula) * 16 + key.power * 2 + key.julia);
+    mix(key.x);
+    mix(key.y);
+    return h;
+}
+
+Tile_cache::Tile_cache(int max_tiles)
+    : tiles(max_tiles)
+{}
+
+Tile_cache::grid Tile_cache::grid_for(const frame_params& params)
+{
+    grid g;
+    g.params = params;
+    split_origin(params.frame_center.x() / params.zoom - params.w / 2.0, g.origin_x, g.phase_x);
+    split_origin(params.frame_center.y() / params.zoom - params.h / 2.0, g.origin_y, g.phase_y);
+    return g;
+}
+
+// Tiles overlapping the frame pixels [from_x, to_x) x [from_y, to_y), row by row
+QVector<Tile_cache::tile_pos> Tile_cache::tiles_in(const grid& g, int from_x, int from_y, int to_x, int to_y)
+{
+    QVector<tile_pos> result;
+    if (from_x >= to_x || from_y >= to_y)
+        return result;
+
+    const qint64 first_x = floor_div(g.origin_x + from_x, TILE_SIZE), last_x = floor_div(g.origin_x + to_x - 1, TILE_SIZE);
+    const qint64 first_y = floor_div(g.origin_y + from_y, TILE_SIZE), last_y = floor_div(g.origin_y + to_y - 1, TILE_SIZE);
+    for (qint64 y = first_y; y <= last_y; y++)
+    {
+        for (qint64 x = first_x; x <= last_x; x++)
+            result.append(tile_pos{x, y});
+    }
+    return result;
+}
+
+// The tile is counted as a frame of zero size centered on its corner, so the
+// row kernel maps its pixel x straight to corner + x * zoom
+void Tile_cache::count_tile(const grid& g, tile_pos pos, int* iters)
+{
+    frame_params params = g.params;
+    params.w = 0;
+    params.h = 0;
+    params.frame_center = QPointF((pos.x * TILE_SIZE + g.phase_x * PHASE_STEP) * params.zoom,
+                                  (pos.y * TILE_SIZE + g.phase_y * PHASE_STEP) * params.zoom);
+    const fractal::kernel counter = fractal::select_kernel(params);
+    for (int y = 0; y < TILE_SIZE; y++)
+        fractal::count_span(counter, params, y, 0, TILE_SIZE, iters + y * TILE_SIZE);
+}
+
+bool Tile_cache::fetch(const grid& g, tile_pos pos, int* iters)
+{
+    QMutexLocker locker(&m);
+    const QVector<int>* tile = tiles.object(key_for(g, pos));
+    if (!tile)
+        return false;
+    std::memcpy(iters, tile->constData(), TILE_SIZE * TILE_SIZE * sizeof(int));
+    return true;
+}
+
+bool Tile_cache::contains(const grid& g, tile_pos pos)
+{
+    QMutexLocker locker(&m);
+    return tiles.contains(key_for(g, pos));
+}
+
+void Tile_cache::store(const grid& g, tile_pos pos, const int* iters)
+{
+    QVector<int>* tile = new QVector<int>(TILE_SIZE * TILE_SIZE);
+    std::memcpy(tile->data(), iters, TILE_SIZE * TILE_SIZE * sizeof(int));
+    QMutexLocker locker(&m);
+    tiles.insert(key_for(g, pos), tile);
+}
+
+tile_key Tile_cache::key_for(const grid& g, tile_pos pos)
+{
+    const frame_params& params = g.params;
+    return tile_key{params.zoom, g.phase_x, g.phase_y, params.max_iter_num, params.formula, params.power,
+                    params.julia, params.julia_c.x(), params.julia_c.y(), pos.x, pos.y};
+}
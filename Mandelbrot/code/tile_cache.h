@@ -0,0 +1,64 @@
+#ifndef TILE_CACHE_H
+#define TILE_CACHE_H
+
+#include <QCache>
+#include <QHash>
+#include <QMutex>
+#include <QVector>
+#include "fractal.h"
+
+// Tiles live on a grid of whole pixels of the complex plane at a given zoom, so
+// a frame panned by whole pixels finds the tiles of the previous one. The grid
+// phase is the fractional pixel offset of the frame, rounded to PHASE_STEP.
+struct tile_key
+{
+    double zoom;
+    qint64 phase_x, phase_y;
+    int max_iter_num;
+    formula_kind formula;
+    int power;
+    bool julia;
+    double julia_re, julia_im;
+    qint64 x, y;
+
+    bool operator==(const tile_key& other) const;
+};
+
+size_t qHash(const tile_key& key, size_t seed = 0);
+
+class Tile_cache
+{
+public:
+    constexpr static int TILE_SIZE = 64;
+    constexpr static int MAX_TILES = 4096;
+    constexpr static double PHASE_STEP = 1e-6;
+
+    struct grid
+    {
+        frame_params params;
+        qint64 origin_x, origin_y;
+        qint64 phase_x, phase_y;
+    };
+
+    struct tile_pos
+    {
+        qint64 x, y;
+    };
+
+    explicit Tile_cache(int max_tiles = MAX_TILES);
+
+    static grid grid_for(const frame_params& params);
+    static QVector<tile_pos> tiles_in(const grid& g, int from_x, int from_y, int to_x, int to_y);
+    static void count_tile(const grid& g, tile_pos pos, int* iters);
+
+    bool fetch(const grid& g, tile_pos pos, int* iters);
+    bool contains(const grid& g, tile_pos pos);
+    void store(const grid& g, tile_pos pos, const int* iters);
+private:
+    QMutex m;
+    QCache<tile_key, QVector<int>> tiles;
+
+    static tile_key key_for(const grid& g, tile_pos pos);
+};
+
+#endif // TILE_CACHE_H
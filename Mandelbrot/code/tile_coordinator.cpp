@@ -0,0 +1,256 @@
+#include "tile_coordinator.h"
+#include <algorithm>
+#include <cstring>
+#include <QThread>
+
+class Tile_coordinator::Link : public QThread
+{
+public:
+    Link(Tile_coordinator* owner, QString address)
+        : owner(owner)
+        , address(address)
+    {}
+
+    virtual void run() override
+    {
+        int reconnects = 0;
+        QString reason;
+        forever
+        {
+            std::unique_ptr<QIODevice> socket = tile_protocol::connect_to(address, reason);
+            if (socket && serve(*socket, reconnects, reason))
+                return;
+
+            {
+                QMutexLocker locker(&owner->m);
+                if (owner->stopping)
+                    return;
+            }
+            if (++reconnects > MAX_RECONNECTS)
+            {
+                owner->link_died(QString("%1: %2").arg(address, reason));
+                return;
+            }
+            QThread::msleep(RECONNECT_DELAY_MS * reconnects);
+        }
+    }
+private:
+    Tile_coordinator* owner;
+    QString address;
+
+    // Returns true when the coordinator stops, false when the connection breaks
+    bool serve(QIODevice& link, int& reconnects, QString& reason)
+    {
+        QVector<int> held;
+        quint32 held_job = 0;
+        QVector<QByteArray> requests;
+        QByteArray payload;
+        tile_protocol::tile_result result;
+        forever
+        {
+            {
+                QMutexLocker locker(&owner->m);
+                if (held.isEmpty())
+                    held_job = owner->job;
+                int id = 0;
+                while (held.size() < TILES_IN_FLIGHT && held_job == owner->job && owner->take_tile(held, id))
+                {
+                    const tile& t = owner->tiles[id];
+                    requests.append(tile_protocol::pack(tile_protocol::tile_request{held_job, static_cast<quint32>(id), owner->params,
+                                                                                    t.from_x, t.to_x, t.from_y, t.to_y}));
+                    held.append(id);
+                }
+                if (held.isEmpty())
+                {
+                    if (owner->stopping)
+                        return true;
+                    owner->work_cond.wait(&owner->m);
+                    continue;
+                }
+            }
+
+            bool ok = true;
+            for (const QByteArray& request : requests)
+                ok = ok && tile_protocol::write_message(link, request, tile_protocol::IO_TIMEOUT_MS);
+            requests.clear();
+
+            // Answers come back in request order
+            ok = ok && tile_protocol::read_message(link, payload, tile_protocol::IO_TIMEOUT_MS)
+                    && tile_protocol::unpack(payload, result)
+                    && result.job == held_job && static_cast<int>(result.tile) == held.front();
+            if (!ok)
+            {
+                reason = link.errorString();
+                owner->release_tiles(held_job, held);
+                return false;
+            }
+
+            owner->store_result(held_job, held.front(), result.iters);
+            held.pop_front();
+            reconnects = 0;
+        }
+    }
+};
+
+Tile_coordinator::Tile_coordinator(const QStringList& addresses)
+    : stopping(false)
+    , alive_links(addresses.size())
+    , job(0)
+    , remaining(0)
+    , failed(false)
+    , iter_field(nullptr)
+    , field_from_h(0)
+{
+    for (const QString& address : addresses)
+    {
+        links.append(new Link(this, address));
+        links.back()->start();
+    }
+}
+
+Tile_coordinator::~Tile_coordinator()
+{
+    {
+        QMutexLocker locker(&m);
+        stopping = true;
+        work_cond.wakeAll();
+    }
+    for (Link* link : links)
+    {
+        link->wait();
+        delete link;
+    }
+}
+
+QString Tile_coordinator::error_string() const
+{
+    return error;
+}
+
+// Fills rows [from_h, to_h) of the frame, iter_field holds just these rows
+bool Tile_coordinator::render(const frame_params& frame, int from_h, int to_h, int* field)
+{
+    QMutexLocker locker(&m);
+    job++;
+    params = frame;
+    tiles.clear();
+    queue.clear();
+    for (int y = from_h; y < to_h; y += TILE_SIZE)
+    {
+        for (int x = 0; x < frame.w; x += TILE_SIZE)
+        {
+            queue.append(tiles.size());
+            tiles.append(tile{x, std::min(x + TILE_SIZE, frame.w), y, std::min(y + TILE_SIZE, to_h), 0, 0, false});
+        }
+    }
+    remaining = tiles.size();
+    failed = false;
+    iter_field = field;
+    field_from_h = from_h;
+    work_cond.wakeAll();
+
+    while (remaining > 0 && !failed && alive_links > 0)
+        done_cond.wait(&m);
+    const bool ok = (remaining == 0);
+    if (!ok && !failed)
+        error = QString("All tile workers are gone: %1").arg(error);
+
+    // Retire the job, so late duplicates never touch the caller's buffer
+    job++;
+    queue.clear();
+    remaining = 0;
+    iter_field = nullptr;
+    return ok;
+}
+
+bool Tile_coordinator::take_tile(const QVector<int>& held, int& id)
+{
+    if (remaining == 0 || failed)
+        return false;
+    if (!queue.isEmpty())
+    {
+        id = queue.takeFirst();
+        tiles[id].holders++;
+        return true;
+    }
+
+    // Nothing left to hand out: help with a tile another link is still counting
+    for (int i = 0; i < tiles.size(); i++)
+    {
+        tile& t = tiles[i];
+        if (!t.done && t.holders > 0 && t.holders < MAX_HOLDERS && !held.contains(i))
+        {
+            t.holders++;
+            id = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Tile_coordinator::store_result(quint32 link_job, int id, const QVector<int>& iters)
+{
+    QMutexLocker locker(&m);
+    if (link_job != job)
+        return;
+
+    tile& t = tiles[id];
+    t.holders--;
+    const int tile_w = t.to_x - t.from_x;
+    if (t.done)
+        return;
+    if (iters.size() != tile_w * (t.to_y - t.from_y))
+    {
+        if (t.holders == 0)
+            retry(id);
+        return;
+    }
+
+    for (int y = t.from_y; y < t.to_y; y++)
+    {
+        std::memcpy(iter_field + (y - field_from_h) * params.w + t.from_x,
+                    iters.constData() + (y - t.from_y) * tile_w, tile_w * sizeof(int));
+    }
+    t.done = true;
+    if (--remaining == 0)
+        done_cond.wakeAll();
+}
+
+void Tile_coordinator::release_tiles(quint32 link_job, const QVector<int>& held)
+{
+    QMutexLocker locker(&m);
+    if (link_job != job)
+        return;
+
+    for (int id : held)
+    {
+        tile& t = tiles[id];
+        t.holders--;
+        if (!t.done && t.holders == 0 && !retry(id))
+            return;
+    }
+}
+
+// Called with the lock held for a tile nobody is counting any more
+bool Tile_coordinator::retry(int id)
+{
+    tile& t = tiles[id];
+    if (++t.attempts >= MAX_ATTEMPTS)
+    {
+        failed = true;
+        error = QString("Tile at %1,%2 failed %3 times").arg(t.from_x).arg(t.from_y).arg(t.attempts);
+        done_cond.wakeAll();
+        return false;
+    }
+    queue.append(id);
+    work_cond.wakeAll();
+    return true;
+}
+
+void Tile_coordinator::link_died(const QString& reason)
+{
+    QMutexLocker locker(&m);
+    alive_links--;
+    error = reason;
+    done_cond.wakeAll();
+}
@@ -0,0 +1,65 @@
+#ifndef TILE_COORDINATOR_H
+#define TILE_COORDINATOR_H
+
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QWaitCondition>
+#include "tile_protocol.h"
+
+// Splits a block of rows into tiles and counts them on remote tile workers.
+// Each worker link keeps a few tiles in flight; a link that runs out of queued
+// tiles duplicates one still held by a slower worker, and the tiles of a link
+// that fails are queued again. The first answer for a tile wins, the counts are
+// the same wherever they come from.
+class Tile_coordinator
+{
+    class Link;
+public:
+    explicit Tile_coordinator(const QStringList& addresses);
+    ~Tile_coordinator();
+
+    bool render(const frame_params& frame, int from_h, int to_h, int* field);
+    QString error_string() const;
+private:
+    struct tile
+    {
+        int from_x, to_x, from_y, to_y;
+        int holders;
+        int attempts;
+        bool done;
+    };
+
+    constexpr static int TILE_SIZE = 128;
+    constexpr static int TILES_IN_FLIGHT = 2;
+    constexpr static int MAX_HOLDERS = 2;
+    constexpr static int MAX_ATTEMPTS = 4;
+    constexpr static int MAX_RECONNECTS = 3;
+    constexpr static int RECONNECT_DELAY_MS = 500;
+
+    QVector<Link*> links;
+    QMutex m;
+    QWaitCondition work_cond;
+    QWaitCondition done_cond;
+    bool stopping;
+    int alive_links;
+
+    quint32 job;
+    frame_params params;
+    QVector<tile> tiles;
+    QVector<int> queue;
+    int remaining;
+    bool failed;
+    int* iter_field;
+    int field_from_h;
+    QString error;
+
+    bool take_tile(const QVector<int>& held, int& id);
+    void store_result(quint32 link_job, int id, const QVector<int>& iters);
+    void release_tiles(quint32 link_job, const QVector<int>& held);
+    bool retry(int id);
+    void link_died(const QString& reason);
+};
+
+#endif // TILE_COORDINATOR_H
@@ -0,0 +1,169 @@
+#include "tile_protocol.h"
+#include <QDataStream>
+#include <QLocalSocket>
+#include <QTcpSocket>
+#include <QtEndian>
+
+namespace
+{
+    bool wait_for(QIODevice& link, qint64 bytes, int timeout_ms)
+    {
+        while (link.bytesAvailable() < bytes)
+        {
+            if (!link.waitForReadyRead(timeout_ms))
+                return false;
+        }
+        return true;
+    }
+
+    // Only what the kernel needs travels, so the worker counts exactly the same values
+    void write_params(QDataStream& out, const frame_params& params)
+    {
+        out << qint32(params.w) << qint32(params.h) << qint32(params.max_iter_num) << params.zoom
+            << params.frame_center.x() << params.frame_center.y() << quint8(params.formula)
+            << qint32(params.power) << params.julia << params.julia_c.x() << params.julia_c.y();
+    }
+
+    void read_params(QDataStream& in, frame_params& params)
+    {
+        qint32 w = 0, h = 0, max_iter_num = 0, power = 0;
+        double center_x = 0, center_y = 0, julia_x = 0, julia_y = 0;
+        quint8 formula = 0;
+        in >> w >> h >> max_iter_num >> params.zoom >> center_x >> center_y >> formula
+           >> power >> params.julia >> julia_x >> julia_y;
+        params.w = w;
+        params.h = h;
+        params.max_iter_num = max_iter_num;
+        params.frame_center = QPointF(center_x, center_y);
+        params.formula = static_cast<formula_kind>(formula);
+        params.power = power;
+        params.julia_c = QPointF(julia_x, julia_y);
+    }
+}
+
+std::unique_ptr<QIODevice> tile_protocol::connect_to(const QString& address, QString& error)
+{
+    if (address.startsWith("unix:"))
+    {
+        std::unique_ptr<QLocalSocket> socket(new QLocalSocket());
+        socket->connectToServer(address.mid(5));
+        if (!socket->waitForConnected(CONNECT_TIMEOUT_MS))
+        {
+            error = socket->errorString();
+            return nullptr;
+        }
+        return socket;
+    }
+
+    const int colon = address.lastIndexOf(':');
+    bool ok = false;
+    const quint16 port = address.mid(colon + 1).toUShort(&ok);
+    if (colon < 1 || !ok)
+    {
+        error = QString("Bad worker address %1").arg(address);
+        return nullptr;
+    }
+
+    std::unique_ptr<QTcpSocket> socket(new QTcpSocket());
+    socket->connectToHost(address.left(colon), port);
+    if (!socket->waitForConnected(CONNECT_TIMEOUT_MS))
+    {
+        error = socket->errorString();
+        return nullptr;
+    }
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    return socket;
+}
+
+bool tile_protocol::read_message(QIODevice& link, QByteArray& payload, int timeout_ms)
+{
+    if (!wait_for(link, sizeof(quint32), timeout_ms))
+        return false;
+
+    quint32 size = 0;
+    if (link.read(reinterpret_cast<char*>(&size), sizeof(size)) != sizeof(size))
+        return false;
+    size = qFromLittleEndian(size);
+    if (size > MAX_MESSAGE || !wait_for(link, size, timeout_ms))
+        return false;
+
+    payload = link.read(size);
+    return payload.size() == static_cast<int>(size);
+}
+
+bool tile_protocol::write_message(QIODevice& link, const QByteArray& payload, int timeout_ms)
+{
+    const quint32 size = qToLittleEndian(static_cast<quint32>(payload.size()));
+    if (link.write(reinterpret_cast<const char*>(&size), sizeof(size)) != sizeof(size)
+        || link.write(payload) != payload.size())
+        return false;
+
+    while (link.bytesToWrite() > 0)
+    {
+        if (!link.waitForBytesWritten(timeout_ms))
+            return false;
+    }
+    return true;
+}
+
+QByteArray tile_protocol::pack(const tile_request& request)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << quint8(message_type::TILE) << request.job << request.tile;
+    write_params(out, request.params);
+    out << qint32(request.from_x) << qint32(request.to_x) << qint32(request.from_y) << qint32(request.to_y);
+    return payload;
+}
+
+QByteArray tile_protocol::pack(const tile_result& result)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << quint8(message_type::RESULT) << result.job << result.tile << quint32(result.iters.size());
+    for (int iter : result.iters)
+        out << qint32(iter);
+    return payload;
+}
+
+bool tile_protocol::unpack(const QByteArray& payload, tile_request& request)
+{
+    QDataStream in(payload);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint8 type = 0;
+    qint32 from_x = 0, to_x = 0, from_y = 0, to_y = 0;
+    in >> type >> request.job >> request.tile;
+    read_params(in, request.params);
+    in >> from_x >> to_x >> from_y >> to_y;
+    request.from_x = from_x;
+    request.to_x = to_x;
+    request.from_y = from_y;
+    request.to_y = to_y;
+
+    return in.status() == QDataStream::Ok && type == quint8(message_type::TILE)
+        && 0 <= from_x && from_x < to_x && to_x <= request.params.w
+        && 0 <= from_y && from_y < to_y && to_y <= request.params.h;
+}
+
+bool tile_protocol::unpack(const QByteArray& payload, tile_result& result)
+{
+    QDataStream in(payload);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint8 type = 0;
+    quint32 count = 0;
+    in >> type >> result.job >> result.tile >> count;
+    if (in.status() != QDataStream::Ok || type != quint8(message_type::RESULT)
+        || count > static_cast<quint32>(payload.size()) / sizeof(qint32))
+        return false;
+
+    result.iters.resize(count);
+    for (int& iter : result.iters)
+    {
+        qint32 value = 0;
+        in >> value;
+        iter = value;
+    }
+    return in.status() == QDataStream::Ok;
+}
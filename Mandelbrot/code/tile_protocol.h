@@ -0,0 +1,52 @@
+#ifndef TILE_PROTOCOL_H
+#define TILE_PROTOCOL_H
+
+#include <memory>
+#include <QByteArray>
+#include <QIODevice>
+#include <QString>
+#include <QVector>
+#include "fractal.h"
+
+// Every message is a 32-bit little-endian payload size followed by the payload.
+// The coordinator sends TILE requests, the worker answers each one with a RESULT
+// carrying the tile's iteration counts row by row.
+namespace tile_protocol
+{
+    enum class message_type : quint8
+    {
+        TILE = 1,
+        RESULT = 2
+    };
+
+    struct tile_request
+    {
+        quint32 job, tile;
+        frame_params params;
+        int from_x, to_x, from_y, to_y;
+    };
+
+    struct tile_result
+    {
+        quint32 job, tile;
+        QVector<int> iters;
+    };
+
+    constexpr int VERSION = 1;
+    constexpr int CONNECT_TIMEOUT_MS = 5000;
+    constexpr int IO_TIMEOUT_MS = 120000;
+    constexpr quint32 MAX_MESSAGE = 256 * 1024 * 1024;
+
+    // "unix:/path" is a Unix domain socket, "host:port" is TCP
+    std::unique_ptr<QIODevice> connect_to(const QString& address, QString& error);
+
+    bool read_message(QIODevice& link, QByteArray& payload, int timeout_ms);
+    bool write_message(QIODevice& link, const QByteArray& payload, int timeout_ms);
+
+    QByteArray pack(const tile_request& request);
+    QByteArray pack(const tile_result& result);
+    bool unpack(const QByteArray& payload, tile_request& request);
+    bool unpack(const QByteArray& payload, tile_result& result);
+}
+
+#endif // TILE_PROTOCOL_H
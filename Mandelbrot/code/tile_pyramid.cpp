@@ -0,0 +1,124 @@
+#include "tile_pyramid.h"
+#include "render_pool.h"
+#include <cstdio>
+#include <QBuffer>
+#include <QDir>
+#include <QSaveFile>
+
+Tile_pyramid::Tile_pyramid(const frame_params& params)
+    : params(params)
+    , written(0)
+{
+    this->params.w = TILE_SIZE;
+    this->params.h = TILE_SIZE;
+    this->params.auto_iter = false;
+    this->params.aa_samples = 0;
+}
+
+bool Tile_pyramid::is_valid(int z, qint64 x, qint64 y)
+{
+    if (z < 0 || z > MAX_LEVEL)
+        return false;
+    const qint64 side = qint64(1) << z;
+    return x >= 0 && x < side && y >= 0 && y < side;
+}
+
+QImage Tile_pyramid::render(int z, qint64 x, qint64 y) const
+{
+    const double tile_span = WORLD_SIZE / (qint64(1) << z);
+    frame_params tile_params = params;
+    tile_params.zoom = tile_span / TILE_SIZE;
+    tile_params.frame_center = QPointF((x + 0.5) * tile_span - WORLD_SIZE / 2, (y + 0.5) * tile_span - WORLD_SIZE / 2);
+
+    const fractal::kernel counter = fractal::select_kernel(tile_params);
+    QImage tile(TILE_SIZE, TILE_SIZE, QImage::Format_RGB888);
+    Render_pool::instance().submit(TILE_SIZE, [&tile_params, &counter, &tile](int y)
+                                   {
+                                       int iter_line[TILE_SIZE];
+                                       fractal::fill_row(counter, tile_params, y, 1, iter_line, tile.scanLine(y));
+                                   })->wait();
+    return tile;
+}
+
+// Children go top-left, top-right, bottom-left, bottom-right; every parent
+// pixel is the mean of the 2x2 child pixels it covers
+QImage Tile_pyramid::downsample(const QImage children[4])
+{
+    const int half = TILE_SIZE / 2;
+    QImage tile(TILE_SIZE, TILE_SIZE, QImage::Format_RGB888);
+    for (int y = 0; y < TILE_SIZE; y++)
+    {
+        unsigned char* out = tile.scanLine(y);
+        const QImage& child = children[(y / half) * 2];
+        const QImage& right_child = children[(y / half) * 2 + 1];
+        const int child_y = (y % half) * 2;
+        for (int x = 0; x < TILE_SIZE; x++)
+        {
+            const QImage& source = x < half ? child : right_child;
+            const unsigned char* top = source.constScanLine(child_y) + (x % half) * 6;
+            const unsigned char* bottom = source.constScanLine(child_y + 1) + (x % half) * 6;
+            for (int c = 0; c < 3; c++)
+                *out++ = (top[c] + top[c + 3] + bottom[c] + bottom[c + 3] + 2) / 4;
+        }
+    }
+    return tile;
+}
+
+QByteArray Tile_pyramid::encode(const QImage& tile)
+{
+    QByteArray png;
+    QBuffer buffer(&png);
+    buffer.open(QIODevice::WriteOnly);
+    tile.save(&buffer, "PNG");
+    return png;
+}
+
+QString Tile_pyramid::tile_path(const QString& dir, int z, qint64 x, qint64 y)
+{
+    return QString("%1/%2/%3/%4.png").arg(dir).arg(z).arg(x).arg(y);
+}
+
+// Only the deepest level is rendered, every level above is downsampled from it.
+// The walk is depth-first, so at most four tiles per level are held at once.
+bool Tile_pyramid::build(int depth, const QString& dir, QString& error)
+{
+    if (depth < 0 || depth > MAX_LEVEL)
+    {
+        error = QString("Pyramid depth must be between 0 and %1").arg(MAX_LEVEL);
+        return false;
+    }
+    written = 0;
+    return !build_node(0, 0, 0, depth, dir, error).isNull();
+}
+
+QImage Tile_pyramid::build_node(int z, qint64 x, qint64 y, int depth, const QString& dir, QString& error)
+{
+    QImage tile;
+    if (z == depth)
+    {
+        tile = render(z, x, y);
+    }
+    else
+    {
+        QImage children[4];
+        for (int i = 0; i < 4; i++)
+        {
+            children[i] = build_node(z + 1, 2 * x + i % 2, 2 * y + i / 2, depth, dir, error);
+            if (children[i].isNull())
+                return QImage();
+        }
+        tile = downsample(children);
+    }
+
+    const QString path = tile_path(dir, z, x, y);
+    QDir().mkpath(QString("%1/%2/%3").arg(dir).arg(z).arg(x));
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(encode(tile)) < 0 || !file.commit())
+    {
+        error = QString("%1: %2").arg(path, file.errorString());
+        return QImage();
+    }
+    if (++written % 256 == 0)
+        std::fprintf(stderr, "%lld tiles written\n", written);
+    return tile;
+}
@@ -0,0 +1,35 @@
+#ifndef TILE_PYRAMID_H
+#define TILE_PYRAMID_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QString>
+#include "fractal.h"
+
+// Map tiles in the usual z/x/y layout: level z splits the square of side
+// WORLD_SIZE around zero into 2^z by 2^z tiles of TILE_SIZE pixels, y grows
+// downwards like the window's rows.
+class Tile_pyramid
+{
+public:
+    constexpr static int TILE_SIZE = 256;
+    constexpr static double WORLD_SIZE = 4.0;
+    constexpr static int MAX_LEVEL = 40;
+
+    explicit Tile_pyramid(const frame_params& params);
+
+    static bool is_valid(int z, qint64 x, qint64 y);
+    QImage render(int z, qint64 x, qint64 y) const;
+    static QImage downsample(const QImage children[4]);
+    static QByteArray encode(const QImage& tile);
+    static QString tile_path(const QString& dir, int z, qint64 x, qint64 y);
+
+    bool build(int depth, const QString& dir, QString& error);
+private:
+    frame_params params;
+    long long written;
+
+    QImage build_node(int z, qint64 x, qint64 y, int depth, const QString& dir, QString& error);
+};
+
+#endif // TILE_PYRAMID_H
@@ -0,0 +1,284 @@
+#include "tile_server.h"
+#include <cstdio>
+#include <QFile>
+#include <QHostAddress>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QThread>
+
+namespace
+{
+    QByteArray http_response(const char* status, const char* type, const QByteArray& body, bool keep_alive)
+    {
+        QByteArray response("HTTP/1.1 ");
+        response.append(status);
+        response.append("\r\nContent-Type: ");
+        response.append(type);
+        response.append("\r\nContent-Length: ");
+        response.append(QByteArray::number(body.size()));
+        response.append(keep_alive ? "\r\n\r\n" : "\r\nConnection: close\r\n\r\n");
+        response.append(body);
+        return response;
+    }
+
+    // "/z/x/y" with an optional ".png"
+    bool parse_tile_path(QByteArray path, int& z, qint64& x, qint64& y)
+    {
+        if (path.endsWith(".png"))
+            path.chop(4);
+        const QList<QByteArray> parts = path.split('/');
+        if (parts.size() != 4 || !parts[0].isEmpty())
+            return false;
+        bool ok_z = false, ok_x = false, ok_y = false;
+        z = parts[1].toInt(&ok_z);
+        x = parts[2].toLongLong(&ok_x);
+        y = parts[3].toLongLong(&ok_y);
+        return ok_z && ok_x && ok_y && Tile_pyramid::is_valid(z, x, y);
+    }
+}
+
+class Tile_server::Session : public QThread
+{
+public:
+    Session(Tile_server* owner, quintptr descriptor, bool is_local)
+        : owner(owner)
+        , descriptor(descriptor)
+        , is_local(is_local)
+    {}
+
+    virtual void run() override
+    {
+        if (is_local)
+        {
+            QLocalSocket socket;
+            if (socket.setSocketDescriptor(descriptor))
+                owner->serve_link(socket);
+        }
+        else
+        {
+            QTcpSocket socket;
+            if (socket.setSocketDescriptor(descriptor))
+            {
+                socket.setSocketOption(QAbstractSocket::LowDelayOption, 1);
+                owner->serve_link(socket);
+            }
+        }
+    }
+private:
+    Tile_server* owner;
+    quintptr descriptor;
+    bool is_local;
+};
+
+class Tile_server::Tcp_listener : public QTcpServer
+{
+public:
+    explicit Tcp_listener(Tile_server* owner)
+        : owner(owner)
+    {}
+protected:
+    virtual void incomingConnection(qintptr handle) override
+    {
+        owner->start_session(handle, false);
+    }
+private:
+    Tile_server* owner;
+};
+
+class Tile_server::Local_listener : public QLocalServer
+{
+public:
+    explicit Local_listener(Tile_server* owner)
+        : owner(owner)
+    {}
+protected:
+    virtual void incomingConnection(quintptr handle) override
+    {
+        owner->start_session(handle, true);
+    }
+private:
+    Tile_server* owner;
+};
+
+Tile_server::Tile_server(QString address, const frame_params& params, QString tile_dir, int cache_mb)
+    : address(address)
+    , pyramid(params)
+    , tile_dir(tile_dir)
+    , tiles(cache_mb * 1024)
+{}
+
+Tile_server::~Tile_server()
+{
+    QMutexLocker locker(&m);
+    for (Session* session : sessions)
+    {
+        session->wait();
+        delete session;
+    }
+}
+
+QString Tile_server::error_string() const
+{
+    return error;
+}
+
+// Listens on "unix:/path" or "host:port" (localhost when the host is left out)
+// and never returns unless listening fails
+bool Tile_server::serve()
+{
+    if (address.startsWith("unix:"))
+    {
+        const QString path = address.mid(5);
+        Local_listener listener(this);
+        QLocalServer::removeServer(path);
+        if (!listener.listen(path))
+        {
+            error = listener.errorString();
+            return false;
+        }
+        std::fprintf(stderr, "Serving map tiles on %s\n", qPrintable(address));
+        forever
+        {
+            listener.waitForNewConnection(-1);
+            drop_finished_sessions();
+        }
+    }
+
+    const int colon = address.lastIndexOf(':');
+    bool ok = false;
+    const quint16 port = address.mid(colon + 1).toUShort(&ok);
+    if (colon < 0 || !ok)
+    {
+        error = QString("Bad listen address %1").arg(address);
+        return false;
+    }
+
+    Tcp_listener listener(this);
+    const QString host = address.left(colon);
+    if (!listener.listen(host.isEmpty() ? QHostAddress(QHostAddress::LocalHost) : QHostAddress(host), port))
+    {
+        error = listener.errorString();
+        return false;
+    }
+    std::fprintf(stderr, "Serving map tiles on http://%s/z/x/y.png\n", qPrintable(address));
+    forever
+    {
+        listener.waitForNewConnection(-1);
+        drop_finished_sessions();
+    }
+}
+
+void Tile_server::start_session(quintptr handle, bool is_local)
+{
+    Session* session = new Session(this, handle, is_local);
+    {
+        QMutexLocker locker(&m);
+        sessions.append(session);
+    }
+    session->start();
+}
+
+void Tile_server::drop_finished_sessions()
+{
+    QMutexLocker locker(&m);
+    for (int i = sessions.size() - 1; i >= 0; i--)
+    {
+        if (sessions[i]->isFinished())
+        {
+            delete sessions[i];
+            sessions.remove(i);
+        }
+    }
+}
+
+// Keep-alive requests on one connection are answered in order
+void Tile_server::serve_link(QIODevice& link)
+{
+    QByteArray buffer;
+    bool keep_alive = true;
+    while (keep_alive)
+    {
+        int head_end = buffer.indexOf("\r\n\r\n");
+        while (head_end < 0)
+        {
+            if (buffer.size() > MAX_REQUEST_BYTES || !link.waitForReadyRead(IO_TIMEOUT_MS))
+                return;
+            buffer.append(link.readAll());
+            head_end = buffer.indexOf("\r\n\r\n");
+        }
+        const QByteArray head = buffer.left(head_end);
+        buffer.remove(0, head_end + 4);
+
+        const QList<QByteArray> request_line = head.left(head.indexOf("\r\n")).split(' ');
+        keep_alive = request_line.size() == 3 && request_line[2] == "HTTP/1.1"
+                     && !head.toLower().contains("connection: close");
+
+        int z = 0;
+        qint64 x = 0, y = 0;
+        QByteArray response;
+        if (request_line.size() != 3)
+            response = http_response("400 Bad Request", "text/plain", "Bad request\n", false);
+        else if (request_line[0] != "GET")
+            response = http_response("405 Method Not Allowed", "text/plain", "Only GET is served\n", keep_alive);
+        else if (!parse_tile_path(request_line[1], z, x, y))
+            response = http_response("404 Not Found", "text/plain", "Tiles are /z/x/y.png\n", keep_alive);
+        else
+            response = http_response("200 OK", "image/png", tile(z, x, y), keep_alive);
+
+        if (link.write(response) != response.size())
+            return;
+        while (link.bytesToWrite() > 0)
+        {
+            if (!link.waitForBytesWritten(IO_TIMEOUT_MS))
+                return;
+        }
+    }
+}
+
+// The first request for a tile produces it, later ones wait for that result
+QByteArray Tile_server::tile(int z, qint64 x, qint64 y)
+{
+    const QString key = QString("%1/%2/%3").arg(z).arg(x).arg(y);
+    std::shared_ptr<pending> job;
+    {
+        QMutexLocker locker(&m);
+        if (const QByteArray* png = tiles.object(key))
+            return *png;
+
+        job = in_flight.value(key);
+        if (job)
+        {
+            while (!job->done)
+                ready_cond.wait(&m);
+            return job->png;
+        }
+        job = std::make_shared<pending>();
+        in_flight.insert(key, job);
+    }
+
+    const QByteArray png = produce(z, x, y);
+    QMutexLocker locker(&m);
+    job->png = png;
+    job->done = true;
+    in_flight.remove(key);
+    tiles.insert(key, new QByteArray(png), png.size() / 1024 + 1);
+    ready_cond.wakeAll();
+    return png;
+}
+
+QByteArray Tile_server::produce(int z, qint64 x, qint64 y)
+{
+    if (!tile_dir.isEmpty())
+    {
+        QFile file(Tile_pyramid::tile_path(tile_dir, z, x, y));
+        if (file.open(QIODevice::ReadOnly))
+        {
+            const QByteArray png = file.readAll();
+            if (!png.isEmpty())
+                return png;
+        }
+    }
+    return Tile_pyramid::encode(pyramid.render(z, x, y));
+}
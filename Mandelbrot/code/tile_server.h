@@ -0,0 +1,61 @@
+#ifndef TILE_SERVER_H
+#define TILE_SERVER_H
+
+#include <memory>
+#include <QByteArray>
+#include <QCache>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+#include <QWaitCondition>
+#include "tile_pyramid.h"
+
+class QIODevice;
+
+// Answers "GET /z/x/y.png" over HTTP with PNG map tiles. Encoded tiles stay in
+// a cache bounded by size, so a repeated request is a hash lookup and a write.
+// Concurrent requests for a tile nobody has yet share one computation; tiles
+// found in a prebuilt pyramid directory are read instead of rendered.
+class Tile_server
+{
+    class Session;
+    class Tcp_listener;
+    class Local_listener;
+public:
+    constexpr static int DEFAULT_CACHE_MB = 256;
+    constexpr static int IO_TIMEOUT_MS = 30000;
+    constexpr static int MAX_REQUEST_BYTES = 8192;
+
+    Tile_server(QString address, const frame_params& params, QString tile_dir = QString(),
+                int cache_mb = DEFAULT_CACHE_MB);
+    ~Tile_server();
+
+    bool serve();
+    QString error_string() const;
+private:
+    struct pending
+    {
+        bool done = false;
+        QByteArray png;
+    };
+
+    QString address;
+    Tile_pyramid pyramid;
+    QString tile_dir;
+    QString error;
+
+    QMutex m;
+    QWaitCondition ready_cond;
+    QCache<QString, QByteArray> tiles;
+    QHash<QString, std::shared_ptr<pending>> in_flight;
+    QVector<Session*> sessions;
+
+    void start_session(quintptr handle, bool is_local);
+    void drop_finished_sessions();
+    void serve_link(QIODevice& link);
+    QByteArray tile(int z, qint64 x, qint64 y);
+    QByteArray produce(int z, qint64 x, qint64 y);
+};
+
+#endif // TILE_SERVER_H
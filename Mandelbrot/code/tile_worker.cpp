@@ -0,0 +1,191 @@
+#include "tile_worker.h"
+#include "render_pool.h"
+#include <cstdio>
+#include <QHostAddress>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QThread>
+
+class Tile_worker::Session : public QThread
+{
+public:
+    Session(quintptr descriptor, bool is_local)
+        : descriptor(descriptor)
+        , is_local(is_local)
+    {}
+
+    virtual void run() override
+    {
+        if (is_local)
+        {
+            QLocalSocket socket;
+            if (socket.setSocketDescriptor(descriptor))
+                Tile_worker::serve_link(socket);
+        }
+        else
+        {
+            QTcpSocket socket;
+            if (socket.setSocketDescriptor(descriptor))
+            {
+                socket.setSocketOption(QAbstractSocket::LowDelayOption, 1);
+                Tile_worker::serve_link(socket);
+            }
+        }
+    }
+private:
+    quintptr descriptor;
+    bool is_local;
+};
+
+class Tile_worker::Tcp_listener : public QTcpServer
+{
+public:
+    explicit Tcp_listener(Tile_worker* owner)
+        : owner(owner)
+    {}
+protected:
+    virtual void incomingConnection(qintptr handle) override
+    {
+        owner->start_session(handle, false);
+    }
+private:
+    Tile_worker* owner;
+};
+
+class Tile_worker::Local_listener : public QLocalServer
+{
+public:
+    explicit Local_listener(Tile_worker* owner)
+        : owner(owner)
+    {}
+protected:
+    virtual void incomingConnection(quintptr handle) override
+    {
+        owner->start_session(handle, true);
+    }
+private:
+    Tile_worker* owner;
+};
+
+Tile_worker::Tile_worker(QString address)
+    : address(address)
+{}
+
+Tile_worker::~Tile_worker()
+{
+    QMutexLocker locker(&m);
+    for (Session* session : sessions)
+    {
+        session->wait();
+        delete session;
+    }
+}
+
+QString Tile_worker::error_string() const
+{
+    return error;
+}
+
+// Listens on "unix:/path" or "host:port" and never returns unless listening fails
+bool Tile_worker::serve()
+{
+    if (address.startsWith("unix:"))
+    {
+        const QString path = address.mid(5);
+        Local_listener listener(this);
+        QLocalServer::removeServer(path);
+        if (!listener.listen(path))
+        {
+            error = listener.errorString();
+            return false;
+        }
+        std::fprintf(stderr, "Serving tiles on %s\n", qPrintable(address));
+        forever
+        {
+            listener.waitForNewConnection(-1);
+            drop_finished_sessions();
+        }
+    }
+
+    const int colon = address.lastIndexOf(':');
+    bool ok = false;
+    const quint16 port = address.mid(colon + 1).toUShort(&ok);
+    if (colon < 0 || !ok)
+    {
+        error = QString("Bad listen address %1").arg(address);
+        return false;
+    }
+
+    Tcp_listener listener(this);
+    const QString host = address.left(colon);
+    if (!listener.listen(host.isEmpty() ? QHostAddress(QHostAddress::Any) : QHostAddress(host), port))
+    {
+        error = listener.errorString();
+        return false;
+    }
+    std::fprintf(stderr, "Serving tiles on %s\n", qPrintable(address));
+    forever
+    {
+        listener.waitForNewConnection(-1);
+        drop_finished_sessions();
+    }
+}
+
+void Tile_worker::start_session(quintptr handle, bool is_local)
+{
+    Session* session = new Session(handle, is_local);
+    {
+        QMutexLocker locker(&m);
+        sessions.append(session);
+    }
+    session->start();
+}
+
+void Tile_worker::drop_finished_sessions()
+{
+    QMutexLocker locker(&m);
+    for (int i = sessions.size() - 1; i >= 0; i--)
+    {
+        if (sessions[i]->isFinished())
+        {
+            delete sessions[i];
+            sessions.remove(i);
+        }
+    }
+}
+
+// Requests on one connection are answered in order; a broken or malformed
+// message ends the session and the coordinator hands its tiles to someone else
+void Tile_worker::serve_link(QIODevice& link)
+{
+    QByteArray payload;
+    tile_protocol::tile_request request;
+    tile_protocol::tile_result result;
+    while (tile_protocol::read_message(link, payload, -1))
+    {
+        if (!tile_protocol::unpack(payload, request))
+            return;
+        render_tile(request, result);
+        if (!tile_protocol::write_message(link, tile_protocol::pack(result), tile_protocol::IO_TIMEOUT_MS))
+            return;
+    }
+}
+
+void Tile_worker::render_tile(const tile_protocol::tile_request& request, tile_protocol::tile_result& result)
+{
+    const int tile_w = request.to_x - request.from_x;
+    const int tile_h = request.to_y - request.from_y;
+    result.job = request.job;
+    result.tile = request.tile;
+    result.iters.resize(tile_w * tile_h);
+
+    int* iters = result.iters.data();
+    const fractal::kernel counter = fractal::select_kernel(request.params);
+    Render_pool::instance().submit(tile_h, [&request, &counter, iters, tile_w](int i)
+                                   {
+                                       fractal::count_span(counter, request.params, request.from_y + i, request.from_x,
+                                                           request.to_x, iters + i * tile_w);
+                                   })->wait();
+}
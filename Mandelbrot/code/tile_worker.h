@@ -0,0 +1,34 @@
+#ifndef TILE_WORKER_H
+#define TILE_WORKER_H
+
+#include <QMutex>
+#include <QString>
+#include <QVector>
+#include "tile_protocol.h"
+
+// Serves tile requests from coordinators. Every connection gets its own thread,
+// the tiles themselves are counted on the shared render pool.
+class Tile_worker
+{
+    class Session;
+    class Tcp_listener;
+    class Local_listener;
+public:
+    explicit Tile_worker(QString address);
+    ~Tile_worker();
+
+    bool serve();
+    QString error_string() const;
+private:
+    QString address;
+    QString error;
+    QMutex m;
+    QVector<Session*> sessions;
+
+    void start_session(quintptr handle, bool is_local);
+    void drop_finished_sessions();
+    static void serve_link(QIODevice& link);
+    static void render_tile(const tile_protocol::tile_request& request, tile_protocol::tile_result& result);
+};
+
+#endif // TILE_WORKER_H
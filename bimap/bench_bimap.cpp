@@ -0,0 +1,114 @@
+// Замеры bimap на неудобных наборах пар: левые ключи по возрастанию и по
+// убыванию при правых, растущих вместе с ними, правые по убыванию, и такие же
+// связанные пары в случайном порядке. Каждый набор вставляется целиком,
+// затем каждая пара ищется по левому ключу, половина удаляется, а остаток
+// копируется и сравнивается с копией. Последняя строка - время вставки и
+// удаления одной пары на случайном наборе.
+// Сборка и запуск (аргумент - число пар, по умолчанию 200000):
+//   g++ -std=c++17 -O2 -DNDEBUG bench_bimap.cpp -o bench_bimap && ./bench_bimap 200000
+// Чтобы сравнить с другой ревизией, положите ее bimap.h рядом с копией этого файла:
+//   mkdir old && git show REV:bimap/bimap.h > old/bimap.h && cp bench_bimap.cpp old/
+#include "bimap.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace
+{
+  using clock_type = std::chrono::steady_clock;
+  using pairs = std::vector<std::pair<int, long>>;
+
+  double seconds(clock_type::time_point from, clock_type::time_point to)
+  {
+    return std::chrono::duration<double>(to - from).count();
+  }
+
+  // Если приоритеты одного дерева зависят от ключей другого, связанные
+  // монотонно стороны вырождают оба дерева в списки
+  void run_adversarial(const char* name, const pairs& data)
+  {
+    auto start = clock_type::now();
+    bimap<int, long> b;
+    for (const auto& p : data)
+      b.insert(p.first, p.second);
+
+    std::size_t found = 0;
+    for (const auto& p : data)
+      found += *b.find_left(p.first).flip() == p.second;
+    for (std::size_t i = 0; i < data.size(); i += 2)
+      b.erase_left(data[i].first);
+
+    bimap<int, long> copy = b;
+    bool equal = copy == b;
+    auto finish = clock_type::now();
+
+    std::printf("%-16s n=%zu %.3f s%s\n", name, data.size(), seconds(start, finish),
+                found == data.size() && equal ? "" : " MISMATCH");
+  }
+
+  // Пропускная способность вставки и удаления, то есть split и merge, на
+  // случайных парах: лучшее время из нескольких прогонов на операцию
+  void run_throughput(const pairs& data, int rounds)
+  {
+    std::vector<int> erase_order(data.size());
+    for (std::size_t i = 0; i < data.size(); i++)
+      erase_order[i] = data[i].first;
+    std::shuffle(erase_order.begin(), erase_order.end(), std::mt19937(2));
+
+    double best_insert = 0, best_erase = 0;
+    for (int r = 0; r < rounds; r++)
+    {
+      bimap<int, long> b;
+      auto start = clock_type::now();
+      for (const auto& p : data)
+        b.insert(p.first, p.second);
+      auto inserted = clock_type::now();
+      for (int key : erase_order)
+        b.erase_left(key);
+      auto erased = clock_type::now();
+
+      double insert_time = seconds(start, inserted), erase_time = seconds(inserted, erased);
+      best_insert = (r == 0 || insert_time < best_insert) ? insert_time : best_insert;
+      best_erase = (r == 0 || erase_time < best_erase) ? erase_time : best_erase;
+    }
+    std::printf("throughput       n=%zu insert %.0f ns/op, erase %.0f ns/op\n", data.size(),
+                best_insert * 1e9 / data.size(), best_erase * 1e9 / data.size());
+  }
+}
+
+int main(int argc, char** argv)
+{
+  const int n = argc > 1 ? std::atoi(argv[1]) : 200000;
+
+  pairs sorted(n);
+  for (int i = 0; i < n; i++)
+    sorted[i] = {i, i * 10L};
+  run_adversarial("sorted", sorted);
+
+  run_adversarial("reverse-sorted", pairs(sorted.rbegin(), sorted.rend()));
+
+  pairs anti(n);
+  for (int i = 0; i < n; i++)
+    anti[i] = {i, -static_cast<long>(i)};
+  run_adversarial("anti-correlated", anti);
+
+  std::mt19937 gen(1);
+  pairs shuffled = sorted;
+  std::shuffle(shuffled.begin(), shuffled.end(), gen);
+  run_adversarial("correlated", shuffled);
+
+  // Несвязанные стороны - ориентир, с которым сравниваются остальные наборы
+  std::vector<long> rights(n);
+  for (int i = 0; i < n; i++)
+    rights[i] = shuffled[i].second;
+  std::shuffle(rights.begin(), rights.end(), gen);
+  for (int i = 0; i < n; i++)
+    shuffled[i].second = rights[i];
+  run_adversarial("independent", shuffled);
+  run_throughput(shuffled, 5);
+}
@@ -3,17 +3,68 @@
 #include <algorithm>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <random>
 #include <stdexcept>
 #include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "hash_group.h"
+
+// Политика хешированной стороны: передается в bimap вместо компаратора
+// этой стороны. Ключи такой стороны ищутся по хеш-таблице за O(1) в среднем
+// без сравнений на порядок, а обходится она в порядке другой стороны
+template <typename Hash, typename Equal = std::equal_to<>>
+struct hashed_index
+{
+  Hash hash;
+  Equal equal;
+
+  hashed_index(Hash hash = Hash(), Equal equal = Equal())
+    : hash(hash), equal(equal)
+  {}
+};
 
 template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
-  typename CompareRight = std::less<Right>>
+  typename CompareRight = std::less<Right>, typename Allocator = std::allocator<std::pair<Left, Right>>,
+  typename Monoid = void>
   class bimap
 {
   class Node;
   class Val_node;
 
+  // Значения моноида по поддереву каждой стороны; без моноида не занимают места
+  struct no_aggregate {};
+  template <typename M>
+  struct side_aggregates
+  {
+    typename M::value_type left_agg;
+    typename M::value_type right_agg;
+  };
+  static constexpr bool has_monoid = !std::is_void_v<Monoid>;
+  using aggregate_base = std::conditional_t<has_monoid, side_aggregates<Monoid>, no_aggregate>;
+
+  // Индекс стороны - декартово дерево по компаратору или хеш-таблица, если
+  // вместо компаратора передан hashed_index. Хешированной может быть только
+  // одна сторона: дерево другой задает порядок обхода обеих
+  template <typename Cmp>
+  struct is_hashed : std::false_type {};
+  template <typename Hash, typename Equal>
+  struct is_hashed<hashed_index<Hash, Equal>> : std::true_type {};
+  static constexpr bool hashed_left = is_hashed<CompareLeft>::value;
+  static constexpr bool hashed_right = is_hashed<CompareRight>::value;
+  static_assert(!hashed_left || !hashed_right, "Both sides hashed: use unordered_bimap");
+  template <bool is_left>
+  static constexpr bool hashed = is_left ? hashed_left : hashed_right;
+  // Сторона, дерево которой есть всегда
+  static constexpr bool tree_side = !hashed_left;
+  // Дерево, в порядке которого обходится сторона
+  template <bool is_left>
+  static constexpr bool order_side = hashed<is_left> ? !is_left : is_left;
+
   template <typename Ptr, typename Cmp>
   struct compressed_pair_impl : public Cmp
   {
@@ -81,7 +132,7 @@ public:
 
     iter& operator++()
     {
-      ptr = Node::template next<is_left>(ptr);
+      ptr = Node::template next<order_side<is_left>>(ptr);
       return *this;
     }
     iter operator++(int)
@@ -93,7 +144,7 @@ public:
 
     iter& operator--()
     {
-      ptr = Node::template prev<is_left>(ptr);
+      ptr = Node::template prev<order_side<is_left>>(ptr);
       return *this;
     }
     iter operator--(int)
@@ -124,47 +175,88 @@ public:
 
   // Создает bimap не содержащий ни одной пары.
   bimap(CompareLeft compare_left = CompareLeft(),
-    CompareRight compare_right = CompareRight())
-    : root(new Node())
-    , left_pair(root.get(), compare_left)
-    , right_pair(root.get(), compare_right)
+    CompareRight compare_right = CompareRight(),
+    Allocator alloc = Allocator())
+    : root_pair(nullptr, node_allocator(alloc))
+    , left_pair(nullptr, compare_left)
+    , right_pair(nullptr, compare_right)
     , node_cnt(0)
     , is_changed(false)
-  {}
+  {
+    root_pair.pointer = create_sentinel();
+    left_pair.pointer = right_pair.pointer = root_pair.pointer;
+  }
 
   // Конструкторы от других и присваивания
   bimap(bimap const& other)
-    : root(new Node())
+    : bimap(other, node_traits::select_on_container_copy_construction(other.root_pair))
+  {}
+
+  // Копия, узлы которой выделяет alloc
+  bimap(bimap const& other, Allocator const& alloc)
+    : root_pair(nullptr, node_allocator(alloc))
     , left_pair(other.left_pair)
     , right_pair(other.right_pair)
     , node_cnt(0)
     , is_changed(true) // Потому что сейчас у нас "чужие" begin_left и begin_right
   {
-    insert_range(other.begin_left(), other.end_left(), other.size());
+    root_pair.pointer = create_sentinel();
+    try
+    {
+      clone_from(other);
+    }
+    catch (...)
+    {
+      destroy();
+      throw;
+    }
   }
 
+  // Перемещенный bimap остается без узлов вообще: его можно только
+  // разрушить или присвоить ему новое значение
   bimap(bimap&& other) noexcept
-    : root(std::move(other.root))
+    : root_pair(std::move(other.root_pair))
     , left_pair(std::move(other.left_pair))
     , right_pair(std::move(other.right_pair))
     , node_cnt(other.node_cnt)
     , is_changed(other.is_changed)
   {
     other.node_cnt = 0;
-    other.left_pair.pointer = other.right_pair.pointer = other.root.get();
+    other.is_changed = false;
+    other.root_pair.pointer = other.left_pair.pointer = other.right_pair.pointer = nullptr;
   }
 
-  bimap& operator=(bimap&& other) noexcept
+  // Узлы можно забрать, только если они выделены аллокатором, который
+  // переходит к нам. Иначе пары переносятся по одной
+  bimap& operator=(bimap&& other) noexcept(std::allocator_traits<Allocator>::propagate_on_container_move_assignment::value
+    || std::allocator_traits<Allocator>::is_always_equal::value)
   {
     if (this == &other) { return *this; }
 
-    clear();
-    root = std::move(other.root);
+    if constexpr (!node_traits::propagate_on_container_move_assignment::value)
+    {
+      if (!(static_cast<node_allocator&>(root_pair) == static_cast<node_allocator&>(other.root_pair)))
+      {
+        clear();
+        static_cast<CompareLeft&>(left_pair) = std::move(static_cast<CompareLeft&>(other.left_pair));
+        static_cast<CompareRight&>(right_pair) = std::move(static_cast<CompareRight&>(other.right_pair));
+        clone_from(other);
+        return *this;
+      }
+    }
+
+    destroy();
+    if constexpr (node_traits::propagate_on_container_move_assignment::value)
+      root_pair = std::move(other.root_pair);
+    else
+      root_pair.pointer = other.root_pair.pointer;
     left_pair = std::move(other.left_pair);
     right_pair = std::move(other.right_pair);
     node_cnt = other.node_cnt;
     is_changed = other.is_changed;
     other.node_cnt = 0;
+    other.is_changed = false;
+    other.root_pair.pointer = other.left_pair.pointer = other.right_pair.pointer = nullptr;
 
     return *this;
   }
@@ -172,25 +264,17 @@ public:
   {
     if (this == &other) { return *this; }
 
-    bimap<left_t, right_t, CompareLeft, CompareRight> backup = std::move(*this);
-    clear();
-    is_changed = true; // Потому что сейчас у нас "чужие" begin_left и begin_right
-    try
-    {
-      insert_range(other.begin_left(), other.end_left(), other.size());
-    }
-    catch (...)
-    {
-      *this = std::move(backup);
-      throw;
-    }
+    if constexpr (node_traits::propagate_on_container_copy_assignment::value)
+      *this = bimap(other, static_cast<const node_allocator&>(other.root_pair));
+    else
+      *this = bimap(other, static_cast<const node_allocator&>(root_pair));
     return *this;
   }
 
   // Деструктор. Вызывается при удалении объектов bimap.
   // Инвалидирует все итераторы ссылающиеся на элементы этого bimap
   // (включая итераторы ссылающиеся на элементы следующие за последними).
-  ~bimap() { clear(); }
+  ~bimap() { destroy(); }
 
   // Вставка пары (left, right), возвращает итератор на left.
   // Если такой left или такой right уже присутствуют в bimap, вставка не
@@ -222,37 +306,10 @@ public:
     if (it == end_left()) { return it; }
 
     node_ptr copy = it.ptr;
-    node_ptr left_par = copy->template parent<true>();
-    node_ptr right_par = copy->template parent<false>();
     it++;
-    node_ptr left_merge_res = merge_left(copy->template go_left<true>(), copy->template go_right<true>());
-    node_ptr right_merge_res = merge_right(copy->template go_left<false>(), copy->template go_right<false>());
-    copy->nullify();
-    if (left_par)
-    {
-      if (copy == left_par->template go_left<true>())
-      {
-        left_par->template attach_left<true>(left_merge_res);
-      }
-      else
-      {
-        left_par->template attach_right<true>(left_merge_res);
-      }
-    }
-
-    if (right_par)
-    {
-      if (copy == right_par->template go_left<false>())
-      {
-        right_par->template attach_left<false>(right_merge_res);
-      }
-      else
-      {
-        right_par->template attach_right<false>(right_merge_res);
-      }
-    }
-
-    delete copy;
+    unlink<true>(copy);
+    unlink<false>(copy);
+    destroy_node(copy);
     node_cnt--;
     is_changed = true;
     return it;
@@ -270,7 +327,12 @@ public:
   bool erase_right(right_t const& right) { return erase<false>(right); }
 
   // erase от ренжа, удаляет [first, last), возвращает итератор на последний
-  // элемент за удаленной последовательностью
+  // элемент за удаленной последовательностью. Диапазон вырезается из дерева
+  // своей стороны двумя разрезами, а из другого дерева его узлы вынимаются
+  // по одному, пересчитывая размеры и моноид их предков: всего
+  // O(log n + k log n) для k пар. Диапазон от n/16 пар пересчитывает
+  // каждого предка один раз на всю пачку и стоит O(k). Если другая сторона
+  // хеширована, O(log n + k)
   left_iterator erase_left(left_iterator first, left_iterator last)
   {
     return erase<true>(first, last);
@@ -339,6 +401,94 @@ public:
     return upper_bound<false>(key, static_cast<CompareRight>(right_pair));
   }
 
+  // Разнородный поиск, как у std::map: если компаратор стороны объявляет
+  // is_transparent, ключом может быть любой сравнимый с ним тип, например
+  // std::string_view или const char* для std::string, без временных объектов
+  template <typename K, typename Cmp = CompareLeft, typename = typename Cmp::is_transparent>
+  left_iterator find_left(K const& left) const
+  {
+    node_ptr temp_it = find_node<true>(left, left_pair);
+    return temp_it ? left_iterator(temp_it) : end_left();
+  }
+  template <typename K, typename Cmp = CompareRight, typename = typename Cmp::is_transparent>
+  right_iterator find_right(K const& right) const
+  {
+    node_ptr temp_it = find_node<false>(right, right_pair);
+    return temp_it ? right_iterator(temp_it) : end_right();
+  }
+
+  template <typename K, typename Cmp = CompareLeft, typename = typename Cmp::is_transparent>
+  right_t const& at_left(K const& key) const { return at<true>(key); }
+  template <typename K, typename Cmp = CompareRight, typename = typename Cmp::is_transparent>
+  left_t const& at_right(K const& key) const { return at<false>(key); }
+
+  template <typename K, typename Cmp = CompareLeft, typename = typename Cmp::is_transparent>
+  left_iterator lower_bound_left(K const& key) const { return lower_bound<true>(key, left_pair); }
+  template <typename K, typename Cmp = CompareRight, typename = typename Cmp::is_transparent>
+  right_iterator lower_bound_right(K const& key) const { return lower_bound<false>(key, right_pair); }
+
+  template <typename K, typename Cmp = CompareLeft, typename = typename Cmp::is_transparent>
+  left_iterator upper_bound_left(K const& key) const { return upper_bound<true>(key, left_pair); }
+  template <typename K, typename Cmp = CompareRight, typename = typename Cmp::is_transparent>
+  right_iterator upper_bound_right(K const& key) const { return upper_bound<false>(key, right_pair); }
+
+  // Итераторы сюда не попадают, их по-прежнему принимает erase по итератору
+  template <typename K, typename Cmp = CompareLeft, typename = typename Cmp::is_transparent,
+    typename = std::enable_if_t<!std::is_convertible_v<K const&, left_iterator>>>
+  bool erase_left(K const& left) { return erase<true>(left); }
+  template <typename K, typename Cmp = CompareRight, typename = typename Cmp::is_transparent,
+    typename = std::enable_if_t<!std::is_convertible_v<K const&, right_iterator>>>
+  bool erase_right(K const& right) { return erase<false>(right); }
+
+  // Порядковые статистики за O(log n): каждое дерево хранит размеры
+  // поддеревьев. rank - число ключей стороны, меньших key; nth - итератор на
+  // index-й по порядку элемент (end, если index >= size()); count - число
+  // ключей из [from, to); distance - расстояние между итераторами стороны
+  template <typename K>
+  std::size_t rank_left(K const& key) const { return rank<true>(side_key<true>(key)); }
+  template <typename K>
+  std::size_t rank_right(K const& key) const { return rank<false>(side_key<false>(key)); }
+
+  left_iterator nth_left(std::size_t index) const { return left_iterator(nth<true>(index)); }
+  right_iterator nth_right(std::size_t index) const { return right_iterator(nth<false>(index)); }
+
+  template <typename K1, typename K2>
+  std::size_t count_left(K1 const& from, K2 const& to) const
+  {
+    std::size_t begin = rank<true>(side_key<true>(from)), end = rank<true>(side_key<true>(to));
+    return end > begin ? end - begin : 0;
+  }
+  template <typename K1, typename K2>
+  std::size_t count_right(K1 const& from, K2 const& to) const
+  {
+    std::size_t begin = rank<false>(side_key<false>(from)), end = rank<false>(side_key<false>(to));
+    return end > begin ? end - begin : 0;
+  }
+
+  std::ptrdiff_t distance_left(left_iterator first, left_iterator last) const
+  {
+    return static_cast<std::ptrdiff_t>(position<true>(last.ptr)) - static_cast<std::ptrdiff_t>(position<true>(first.ptr));
+  }
+  std::ptrdiff_t distance_right(right_iterator first, right_iterator last) const
+  {
+    return static_cast<std::ptrdiff_t>(position<false>(last.ptr)) - static_cast<std::ptrdiff_t>(position<false>(first.ptr));
+  }
+
+  // Если задан Monoid (value_type, identity(), lift(left, right) и
+  // ассоциативный combine(a, b)), каждое дерево хранит его свертку по
+  // поддеревьям, и свертка по парам с ключом стороны из [from, to), взятая
+  // в порядке этих ключей, считается за O(log n)
+  template <typename K1, typename K2, typename M = Monoid, typename = std::enable_if_t<!std::is_void_v<M>>>
+  typename M::value_type aggregate_left(K1 const& from, K2 const& to) const
+  {
+    return aggregate<true>(side_key<true>(from), side_key<true>(to));
+  }
+  template <typename K1, typename K2, typename M = Monoid, typename = std::enable_if_t<!std::is_void_v<M>>>
+  typename M::value_type aggregate_right(K1 const& from, K2 const& to) const
+  {
+    return aggregate<false>(side_key<false>(from), side_key<false>(to));
+  }
+
   // Возващает итератор на минимальный по порядку left.
   left_iterator begin_left() const
   {
@@ -347,7 +497,7 @@ public:
     return left_iterator(left_pair.pointer);
   }
   // Возващает итератор на следующий за последним по порядку left.
-  left_iterator end_left() const { return left_iterator(root.get()); }
+  left_iterator end_left() const { return left_iterator(root_pair.pointer); }
 
   // Возващает итератор на минимальный по порядку right.
   right_iterator begin_right() const
@@ -357,16 +507,50 @@ public:
     return right_iterator(right_pair.pointer);
   }
   // Возващает итератор на следующий за последним по порядку right.
-  right_iterator end_right() const { return right_iterator(root.get()); }
+  right_iterator end_right() const { return right_iterator(root_pair.pointer); }
 
   void clear()
   {
-    erase_left(begin_left(), end_left());
-    root.reset(new Node());
+    if (root_pair.pointer && !release_nodes())
+    {
+      destroy_subtree<tree_side>(root_pair.pointer->template go_left<tree_side>(), false);
+      if constexpr (!hashed_left)
+        root_pair.pointer->template attach_left<true>(nullptr);
+      if constexpr (!hashed_right)
+        root_pair.pointer->template attach_left<false>(nullptr);
+    }
+    if (!root_pair.pointer)
+      root_pair.pointer = create_sentinel();
+    reset_index<true>();
+    reset_index<false>();
+    left_pair.pointer = right_pair.pointer = root_pair.pointer;
     is_changed = false;
     node_cnt = 0;
   }
 
+  // Вставляет пары из [first, last) (элементы с полями first и second) и
+  // возвращает, сколько из них вставлено. Пара отбрасывается, если ее левый
+  // или правый ключ уже есть в bimap; из пар пачки с одинаковым левым ключом
+  // остается первая, затем так же отбрасываются повторы правых ключей (из
+  // них остается первая по порядку в пачке).
+  // Пачка сортируется и сливается с каждым деревом за O(m log(n/m + 1)),
+  // в хеш-таблицу пары добавляются по одной
+  template <typename InputIt>
+  std::size_t insert_bulk(InputIt first, InputIt last)
+  {
+    return insert_batch(first, last);
+  }
+
+  // Заменяет содержимое парами из [first, last), повторы отбрасываются как
+  // в insert_bulk. Если пары отсортированы по левому ключу, нужна только
+  // одна сортировка по правым ключам, а оба дерева строятся за линейное время
+  template <typename InputIt>
+  void assign_sorted(InputIt first, InputIt last)
+  {
+    clear();
+    insert_batch(first, last);
+  }
+
   // Проверка на пустоту
   bool empty() const { return node_cnt == 0; }
 
@@ -395,12 +579,145 @@ public:
   friend bool operator!=(bimap const& a, bimap const& b) { return !(a == b); }
 
 private:
-  std::unique_ptr<Node> root;
-  mutable compressed_pair_impl<node_ptr, CompareLeft> left_pair;
-  mutable compressed_pair_impl<node_ptr, CompareRight> right_pair;
+  using node_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Val_node>;
+  using node_traits = std::allocator_traits<node_allocator>;
+  using sentinel_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+  using sentinel_traits = std::allocator_traits<sentinel_allocator>;
+
+  // Хеш-таблица хешированной стороны: группы управляющих байт и указатели
+  // на узлы. Копия получает только функторы, таблицу заполняет clone_from
+  template <typename Index>
+  struct node_table : Index
+  {
+    std::vector<std::int8_t> ctrl;
+    std::vector<node_ptr> slots;
+    std::size_t group_count = 0;
+    std::size_t deleted_cnt = 0;
+
+    node_table(const Index& index) : Index(index) {}
+    node_table(const node_table& other) : Index(other) {}
+
+    node_table(node_table&& other) noexcept
+      : Index(std::move(other))
+      , ctrl(std::move(other.ctrl))
+      , slots(std::move(other.slots))
+      , group_count(other.group_count)
+      , deleted_cnt(other.deleted_cnt)
+    {
+      other.forget();
+    }
+
+    node_table& operator=(node_table&& other) noexcept
+    {
+      static_cast<Index&>(*this) = std::move(static_cast<Index&>(other));
+      ctrl = std::move(other.ctrl);
+      slots = std::move(other.slots);
+      group_count = other.group_count;
+      deleted_cnt = other.deleted_cnt;
+      other.forget();
+      return *this;
+    }
+    node_table& operator=(const node_table&) = delete;
+
+    void forget() noexcept
+    {
+      ctrl.clear();
+      slots.clear();
+      group_count = deleted_cnt = 0;
+    }
+  };
+  template <typename Cmp>
+  using side_store = std::conditional_t<is_hashed<Cmp>::value, node_table<Cmp>, Cmp>;
+
+  // Фиктивный корень (он же end) вместе с аллокатором узлов
+  compressed_pair_impl<node_ptr, node_allocator> root_pair;
+  mutable compressed_pair_impl<node_ptr, side_store<CompareLeft>> left_pair;
+  mutable compressed_pair_impl<node_ptr, side_store<CompareRight>> right_pair;
   size_t node_cnt;
   mutable bool is_changed;
 
+  template <class... Args>
+  node_ptr create_node(Args&& ... args)
+  {
+    node_allocator& alloc = root_pair;
+    Val_node* node = node_traits::allocate(alloc, 1);
+    try
+    {
+      node_traits::construct(alloc, node, std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+      node_traits::deallocate(alloc, node, 1);
+      throw;
+    }
+    return node;
+  }
+
+  void destroy_node(node_ptr node)
+  {
+    node_allocator& alloc = root_pair;
+    Val_node* val = static_cast<Val_node*>(node);
+    node_traits::destroy(alloc, val);
+    node_traits::deallocate(alloc, val, 1);
+  }
+
+  node_ptr create_sentinel()
+  {
+    sentinel_allocator alloc(static_cast<node_allocator&>(root_pair));
+    Node* node = sentinel_traits::allocate(alloc, 1);
+    sentinel_traits::construct(alloc, node);
+    return node;
+  }
+
+  void destroy_sentinel(node_ptr node)
+  {
+    sentinel_allocator alloc(static_cast<node_allocator&>(root_pair));
+    sentinel_traits::destroy(alloc, node);
+    sentinel_traits::deallocate(alloc, node, 1);
+  }
+
+  template <typename Alloc, typename = void>
+  struct has_release : std::false_type {};
+  template <typename Alloc>
+  struct has_release<Alloc, std::void_t<decltype(std::declval<Alloc&>().release()),
+    decltype(std::declval<const Alloc&>().owns_pool())>> : std::true_type {};
+
+  // Если аллокатор - пул, которым больше никто не пользуется, все узлы
+  // вместе с фиктивным корнем освобождаются сбросом его слэбов; обход
+  // нужен только ради деструкторов пар
+  bool release_nodes()
+  {
+    if constexpr (has_release<node_allocator>::value)
+    {
+      node_allocator& alloc = root_pair;
+      if (!alloc.owns_pool())
+        return false;
+
+      if constexpr (!std::is_trivially_destructible_v<left_t> || !std::is_trivially_destructible_v<right_t>)
+      {
+        for (node_ptr curr = Node::template minimum<tree_side>(root_pair.pointer); curr != root_pair.pointer;
+          curr = Node::template next<tree_side>(curr))
+          node_traits::destroy(alloc, static_cast<Val_node*>(curr));
+      }
+      alloc.release();
+      root_pair.pointer = nullptr;
+      return true;
+    }
+    else
+      return false;
+  }
+
+  // Освобождает все узлы и фиктивный корень, если он есть
+  void destroy()
+  {
+    if (root_pair.pointer && !release_nodes())
+    {
+      destroy_subtree<tree_side>(root_pair.pointer->template go_left<tree_side>(), false);
+      destroy_sentinel(root_pair.pointer);
+    }
+    root_pair.pointer = nullptr;
+  }
+
   template <bool is_left>
   static std::conditional_t<is_left, const left_t&, const right_t&> get(const node_ptr node)
   {
@@ -416,21 +733,25 @@ private:
   template <bool is_left>
   using cmp_type = std::conditional_t<is_left, CompareLeft, CompareRight>;
 
-  template <bool is_left>
-  node_ptr const find_node(const val_type<is_left>& key,
-    const cmp_type<is_left>& cmp) const
+  template <bool is_left, typename K>
+  node_ptr const find_node(const K& key, const cmp_type<is_left>& cmp) const
   {
-    node_ptr curr = root->template go_left<is_left>();
-    while (curr)
+    if constexpr (hashed<is_left>)
+      return hash_find<is_left>(key, key_hash<is_left>(key));
+    else
     {
-      if (cmp(get<is_left>(curr), key))
-        curr = curr->template go_right<is_left>();
-      else if (cmp(key, get<is_left>(curr)))
-        curr = curr->template go_left<is_left>();
-      else
-        return curr;
+      node_ptr curr = root_pair.pointer->template go_left<is_left>();
+      while (curr)
+      {
+        if (cmp(get<is_left>(curr), key))
+          curr = curr->template go_right<is_left>();
+        else if (cmp(key, get<is_left>(curr)))
+          curr = curr->template go_left<is_left>();
+        else
+          return curr;
+      }
+      return nullptr;
     }
-    return nullptr;
   }
   node_ptr const find_node_left(const left_t& key) const
   {
@@ -441,52 +762,29 @@ private:
     return find_node<false>(key, static_cast<CompareRight>(right_pair));
   }
 
-  void insert_range(const left_iterator other_begin, const left_iterator other_end, int size)
-  {
-    size_t count = 0;
-    left_iterator pivot1 = other_begin;
-    while (count != size / 2 && pivot1 != other_end)
-    {
-      pivot1++;
-      count++;
-    }
-    if (pivot1 == other_end) 
-      pivot1--;
-
-    insert(*pivot1, *(pivot1.flip()));
-    size--;
-    left_iterator pivot2 = pivot1--;
-    pivot2++;
-    while (pivot2 != other_end && size > 0)
-    {
-      insert(*pivot2, *(pivot2.flip()));
-      pivot2++;
-      size--;
-    }
-    while (pivot1 != other_begin && size > 0)
-    {
-      insert(*pivot1, *(pivot1.flip()));
-      pivot1--;
-      size--;
-    }
-    if (size > 0) 
-      insert(*pivot1, *(pivot1.flip()));
-  }
-
   template <class... Args>
   left_iterator emplace(const left_t& left_key, const right_t& right_key, Args&& ... args)
   {
     if (find_left(left_key) == end_left() &&
       find_right(right_key) == end_right())
     {
-      node_ptr to_insert = new Val_node(std::forward<Args>(args)...);
-      std::pair<node_ptr, node_ptr> split_res = split_left(root->template go_left<true>(), left_key);
-      node_ptr left_merge_res = merge_left(merge_left(split_res.first, to_insert), split_res.second);
-      root->template attach_left<true>(left_merge_res);
-
-      split_res = split_right(root->template go_left<false>(), right_key);
-      node_ptr right_merge_res = merge_right(merge_right(split_res.first, to_insert), split_res.second);
-      root->template attach_left<false>(right_merge_res);
+      // Хеш и место в таблице готовятся до создания узла, чтобы исключение
+      // не оставило его висеть
+      std::uint32_t left_hash = 0, right_hash = 0;
+      if constexpr (hashed_left)
+      {
+        left_hash = key_hash<true>(left_key);
+        hash_reserve<true>(node_cnt + 1);
+      }
+      if constexpr (hashed_right)
+      {
+        right_hash = key_hash<false>(right_key);
+        hash_reserve<false>(node_cnt + 1);
+      }
+      // Ключи могли быть перемещены в узел, поэтому дальше режем по его копиям
+      node_ptr to_insert = create_node(std::forward<Args>(args)...);
+      attach_node<true>(to_insert, left_hash);
+      attach_node<false>(to_insert, right_hash);
 
       is_changed = true;
       node_cnt++;
@@ -496,170 +794,1095 @@ private:
       return end_left();
   }
 
-  void recalc() const
-  {
-    left_pair.pointer = Node::template minimum<true>(root.get());
-    right_pair.pointer = Node::template minimum<false>(root.get());
-    is_changed = false;
-  }
-
+  // Добавляет узел с новым ключом в индекс стороны: в дерево разрезом и
+  // двумя слияниями, в хеш-таблицу - с уже посчитанным хешем
   template <bool is_left>
-  std::pair<node_ptr, node_ptr> split(node_ptr t, const val_type<is_left>& key, const cmp_type<is_left>& cmp)
+  void attach_node(node_ptr node, std::uint32_t hash)
   {
-    if (!t) { return { nullptr, nullptr }; }
-
-    if (cmp(get<is_left>(t), key))
+    if constexpr (hashed<is_left>)
     {
-      auto split_res = split<is_left>(t->template go_right<is_left>(), key, cmp);
-      t->template attach_right<is_left>(split_res.first);
-      return { t, split_res.second };
+      node->template priority<is_left>() = hash;
+      hash_place<is_left>(node);
     }
     else
     {
-      auto split_res = split<is_left>(t->template go_left<is_left>(), key, cmp);
-      t->template attach_left<is_left>(split_res.second);
-      return { split_res.first, t };
+      node_ptr root = root_pair.pointer;
+      std::pair<node_ptr, node_ptr> parts = split<is_left>(root->template go_left<is_left>(),
+        get<is_left>(node), compare<is_left>());
+      root->template attach_left<is_left>(merge<is_left>(merge<is_left>(parts.first, node), parts.second));
     }
   }
-  std::pair<node_ptr, node_ptr> split_left(node_ptr t, const left_t& key)
-  {
-    return split<true>(t, key, static_cast<CompareLeft>(left_pair));
-  }
-  std::pair<node_ptr, node_ptr> split_right(node_ptr t, const right_t& key)
-  {
-    return split<false>(t, key, static_cast<CompareRight>(right_pair));
-  }
 
-  template <bool is_left>
-  node_ptr merge(node_ptr t1, node_ptr t2, const cmp_type<is_left>& prim_cmp, const cmp_type<!is_left>& sec_cmp)
+  // Открытая адресация по адресу исходного узла, живет только пока идет
+  // копирование
+  class node_map
   {
-    if (!t2) { return t1; }
-    if (!t1) { return t2; }
-    if (prim_cmp(get<is_left>(t2), get<is_left>(t1)))
+  public:
+    explicit node_map(std::size_t count)
     {
-      std::swap(t1, t2);
+      std::size_t capacity = 16;
+      while (capacity < count + count / 2)
+        capacity *= 2;
+      slots.assign(capacity, { nullptr, nullptr });
+      mask = capacity - 1;
     }
-    if (sec_cmp(get<!is_left>(t1), get<!is_left>(t2)))
+
+    void insert(node_ptr from, node_ptr to)
     {
-      t1->template attach_right<is_left>(merge<is_left>(t1->template go_right<is_left>(), t2, prim_cmp, sec_cmp));
-      return t1;
+      std::size_t i = slot(from);
+      while (slots[i].first)
+        i = (i + 1) & mask;
+      slots[i] = { from, to };
     }
-    else
+
+    node_ptr find(node_ptr from) const
     {
-      t2->template attach_left<is_left>(merge<is_left>(t1, t2->template go_left<is_left>(), prim_cmp, sec_cmp));
-      return t2;
+      if (!from)
+        return nullptr;
+      std::size_t i = slot(from);
+      while (slots[i].first != from)
+        i = (i + 1) & mask;
+      return slots[i].second;
     }
-  }
-  node_ptr merge_left(node_ptr t1, node_ptr t2)
-  {
-    return merge<true>(t1, t2, static_cast<CompareLeft>(left_pair), static_cast<CompareRight>(right_pair));
-  }
-  node_ptr merge_right(node_ptr t1, node_ptr t2)
-  {
-    return merge<false>(t1, t2, static_cast<CompareRight>(right_pair), static_cast<CompareLeft>(left_pair));
-  }
 
-  template <bool is_left>
-  val_type<!is_left> const& at(val_type<is_left> const& key) const
-  {
-    node_ptr temp_it;
-    if constexpr (is_left)
-      temp_it = find_node_left(key);
-    else
-      temp_it = find_node_right(key);
-    
-    if (!temp_it)
+    const std::vector<std::pair<node_ptr, node_ptr>>& entries() const { return slots; }
+
+  private:
+    std::vector<std::pair<node_ptr, node_ptr>> slots;
+    std::size_t mask;
+
+    std::size_t slot(node_ptr node) const
     {
-      throw std::out_of_range("element with given key doesn't exist");
+      std::uint64_t hash = (reinterpret_cast<std::uintptr_t>(node) >> 4) * 0x9E3779B97F4A7C15ull;
+      return static_cast<std::size_t>(hash >> 32) & mask;
     }
-    return get<!is_left>(temp_it);
-  }
+  };
 
-  template <bool is_left> bool erase(val_type<is_left> const& key)
+  // Копирует оба индекса за O(n), сохраняя их форму и приоритеты: сначала
+  // создаются копии всех узлов, затем связи и указатели хеш-таблицы
+  // переводятся по таблице "исходный узел -> копия". Ожидает пустое дерево
+  void clone_from(const bimap& other)
   {
-    iterator<is_left> it(nullptr);
-    bool not_exist;
-    if constexpr (is_left)
+    if (other.empty())
+      return;
+
+    node_ptr other_root = other.root_pair.pointer;
+    node_map copies(other.size());
+    try
     {
-      it = find_left(key);
-      not_exist = (it == end_left());
+      copy_index<true>(other);
+      copy_index<false>(other);
+      for (node_ptr curr = Node::template minimum<tree_side>(other_root); curr != other_root;
+        curr = Node::template next<tree_side>(curr))
+      {
+        node_ptr copy = create_node(get<true>(curr), get<false>(curr));
+        copy->left_priority = curr->left_priority;
+        copy->right_priority = curr->right_priority;
+        copy_augmentation(curr, copy);
+        copies.insert(curr, copy);
+      }
     }
-    else
+    catch (...)
     {
-      it = find_right(key);
-      not_exist = (it == end_right());
+      for (const std::pair<node_ptr, node_ptr>& entry : copies.entries())
+      {
+        if (entry.second)
+          destroy_node(entry.second);
+      }
+      reset_index<true>();
+      reset_index<false>();
+      throw;
     }
 
-    if (not_exist) 
-      return false;
-    else
+    for (node_ptr curr = Node::template minimum<tree_side>(other_root); curr != other_root;
+      curr = Node::template next<tree_side>(curr))
     {
-      if constexpr (is_left)
-        erase_left(it);
-      else 
-        erase_right(it);
-
-      return true;
+      node_ptr copy = copies.find(curr);
+      if constexpr (!hashed_left)
+      {
+        copy->template attach_left<true>(copies.find(curr->template go_left<true>()));
+        copy->template attach_right<true>(copies.find(curr->template go_right<true>()));
+      }
+      if constexpr (!hashed_right)
+      {
+        copy->template attach_left<false>(copies.find(curr->template go_left<false>()));
+        copy->template attach_right<false>(copies.find(curr->template go_right<false>()));
+      }
     }
+    if constexpr (!hashed_left)
+      root_pair.pointer->template attach_left<true>(copies.find(other_root->template go_left<true>()));
+    if constexpr (!hashed_right)
+      root_pair.pointer->template attach_left<false>(copies.find(other_root->template go_left<false>()));
+    relink_index<true>(other, copies);
+    relink_index<false>(other, copies);
+    node_cnt = other.size();
+    is_changed = true;
   }
 
-  template <bool is_left>
-  iterator<is_left> erase(iterator<is_left> first, iterator<is_left> last)
+  template <typename InputIt>
+  std::size_t insert_batch(InputIt first, InputIt last)
   {
-    while (first != last)
+    std::vector<node_ptr> nodes;
+    try
     {
-      if constexpr (is_left)
-        erase_left(first++);
-      else 
-        erase_right(first++); 
+      for (; first != last; ++first)
+      {
+        nodes.push_back(nullptr);
+        nodes.back() = create_node(first->first, first->second);
+      }
+      return attach_batch(nodes);
+    }
+    catch (...)
+    {
+      for (node_ptr node : nodes)
+      {
+        if (node)
+          destroy_node(node);
+      }
+      throw;
     }
-    return last;
   }
 
-  template <bool is_left>
-  iterator<is_left> lower_bound(const val_type<is_left>& key, const cmp_type<is_left>& cmp) const
+  // Добавляет в индексы узлы из nodes, отбрасывая повторы и уже занятые
+  // ключи, и забирает их себе. Пока идет отбор, сравнения могут бросить
+  // исключение, и узлы остаются в nodes нетронутыми, а хеш-таблицы прежними
+  std::size_t attach_batch(std::vector<node_ptr>& nodes)
   {
-    node_ptr curr = root->template go_left<is_left>();
-    node_ptr res = nullptr;
-    while (curr)
+    std::vector<node_ptr> by_left(nodes);
+    filter_batch<true>(by_left);
+    std::vector<node_ptr> by_right;
+    try
     {
-      if (cmp(get<is_left>(curr), key))
-      {
-        curr = curr->template go_right<is_left>();
-      }
+      // Из повторов правого ключа, как и левого, остается первая пара пачки,
+      // поэтому узлы идут в порядке nodes, а не отсортированными по левому
+      if constexpr (hashed_left)
+        by_right = by_left;
       else
       {
-        res = curr;
-        curr = curr->template go_left<is_left>();
+        by_right.reserve(by_left.size());
+        for (node_ptr node : by_left)
+          node->template attach_left<tree_side>(node);
+        for (node_ptr node : nodes)
+        {
+          if (node->template go_left<tree_side>() == node)
+            by_right.push_back(node);
+        }
+        for (node_ptr node : by_left)
+          node->template attach_left<tree_side>(nullptr);
       }
+      filter_batch<false>(by_right);
     }
-
-    if (res) 
-      return iterator<is_left>(res); 
-    else if constexpr (is_left)
-      return end_left(); 
-    else 
-      return end_right();
-  }
-
-  template <bool is_left>
-  iterator<is_left> upper_bound(const val_type<is_left>& key, const cmp_type<is_left>& cmp) const
-  {
-    node_ptr curr = root->template go_left<is_left>();
-    node_ptr res = nullptr;
-    while (curr)
+    catch (...)
     {
-      if (cmp(key, get<is_left>(curr)))
+      if constexpr (hashed_left)
       {
-        res = curr;
-        curr = curr->template go_left<is_left>();
+        for (node_ptr node : by_left)
+          hash_remove<true>(node);
       }
-      else
+      throw;
+    }
+    std::vector<node_ptr> stack;
+    stack.reserve(by_right.size());
+
+    // Оставшиеся узлы на время помечаются ссылкой на самих себя в дереве,
+    // остальные освобождаются
+    for (node_ptr node : by_right)
+      node->template attach_left<tree_side>(node);
+    auto dropped = [](node_ptr node) { return node->template go_left<tree_side>() != node; };
+    if constexpr (hashed_left)
+    {
+      for (node_ptr node : by_left)
       {
-        curr = curr->template go_right<is_left>();
+        if (dropped(node))
+          hash_remove<true>(node);
       }
     }
-
+    by_left.erase(std::remove_if(by_left.begin(), by_left.end(), dropped), by_left.end());
+    for (node_ptr node : nodes)
+    {
+      if (dropped(node))
+        destroy_node(node);
+      else
+        node->template attach_left<tree_side>(nullptr);
+    }
+    nodes.clear();
+    if (by_left.empty())
+      return 0;
+
+    node_ptr root = root_pair.pointer;
+    if constexpr (!hashed_left)
+      root->template attach_left<true>(unite<true>(root->template go_left<true>(),
+        build_cartesian<true>(by_left, stack)));
+    if constexpr (!hashed_right)
+      root->template attach_left<false>(unite<false>(root->template go_left<false>(),
+        build_cartesian<false>(by_right, stack)));
+    node_cnt += by_left.size();
+    is_changed = true;
+    return by_left.size();
+  }
+
+  // Оставляет в nodes узлы с новыми ключами стороны is_left. Для дерева они
+  // сортируются и сверяются с ним обходом, из равных остается первый; в
+  // хеш-таблицу узлы сразу вставляются по порядку
+  template <bool is_left>
+  void filter_batch(std::vector<node_ptr>& nodes)
+  {
+    if constexpr (hashed<is_left>)
+      hash_claim<is_left>(nodes);
+    else
+    {
+      const cmp_type<is_left>& cmp = compare<is_left>();
+      auto less = [&cmp](node_ptr a, node_ptr b) { return cmp(get<is_left>(a), get<is_left>(b)); };
+      if (!std::is_sorted(nodes.begin(), nodes.end(), less))
+        std::stable_sort(nodes.begin(), nodes.end(), less);
+      drop_repeats(nodes, less);
+      drop_present<is_left>(root_pair.pointer->template go_left<is_left>(), nodes.data(),
+        nodes.data() + nodes.size(), less);
+    }
+    nodes.erase(std::remove(nodes.begin(), nodes.end(), nullptr), nodes.end());
+  }
+
+  // Зануляет в отсортированном [first, last) узлы, ключ которых уже есть в
+  // дереве t. Каждый узел дерева делит диапазон бинарным поиском, и спуск
+  // идет только туда, где диапазон не пуст
+  template <bool is_left, typename Less>
+  static void drop_present(node_ptr t, node_ptr* first, node_ptr* last, Less less)
+  {
+    while (t && first != last)
+    {
+      node_ptr* mid = std::lower_bound(first, last, t, less);
+      node_ptr* after = mid;
+      if (mid != last && !less(t, *mid))
+      {
+        *mid = nullptr;
+        after = mid + 1;
+      }
+      drop_present<is_left>(t->template go_left<is_left>(), first, mid, less);
+      first = after;
+      t = t->template go_right<is_left>();
+    }
+  }
+
+  // Объединение деревьев с непересекающимися ключами: корень с большим
+  // приоритетом разрезает другое дерево своим ключом. Глубина рекурсии не
+  // больше суммы глубин, а работа - O(m log(n/m + 1)) для деревьев из n и m узлов
+  template <bool is_left>
+  node_ptr unite(node_ptr a, node_ptr b)
+  {
+    if (!a)
+      return b;
+    if (!b)
+      return a;
+    if (a->template priority<is_left>() < b->template priority<is_left>())
+      std::swap(a, b);
+
+    std::pair<node_ptr, node_ptr> parts = split<is_left>(b, get<is_left>(a), compare<is_left>());
+    a->template attach_left<is_left>(unite<is_left>(a->template go_left<is_left>(), parts.first));
+    a->template attach_right<is_left>(unite<is_left>(a->template go_right<is_left>(), parts.second));
+    pull<is_left>(a);
+    return a;
+  }
+
+  template <bool is_left>
+  const cmp_type<is_left>& compare() const
+  {
+    if constexpr (is_left)
+      return left_pair;
+    else
+      return right_pair;
+  }
+
+  template <bool is_left>
+  side_store<cmp_type<is_left>>& index_table() const
+  {
+    if constexpr (is_left)
+      return left_pair;
+    else
+      return right_pair;
+  }
+
+  // Хеш ключа хешированной стороны. Узел хранит его вместо приоритета, так
+  // что перестроение и удаление обходятся без вызовов хеш-функции
+  template <bool is_left, typename K>
+  std::uint32_t key_hash(const K& key) const
+  {
+    return static_cast<std::uint32_t>(hash_group::mix(static_cast<std::uint64_t>(index_table<is_left>().hash(key))));
+  }
+
+  template <bool is_left, typename K>
+  node_ptr hash_find(const K& key, std::uint32_t hash) const
+  {
+    const auto& table = index_table<is_left>();
+    if (table.group_count == 0)
+      return nullptr;
+
+    std::int8_t byte = hash_group::control_byte(hash);
+    std::size_t mask = table.group_count - 1;
+    std::size_t group = (hash >> 7) & mask;
+    for (std::size_t step = 1; step <= table.group_count; step++)
+    {
+      const std::int8_t* ctrl = table.ctrl.data() + group * hash_group::SIZE;
+      for (std::uint32_t candidates = hash_group::match(ctrl, byte); candidates; candidates &= candidates - 1)
+      {
+        node_ptr node = table.slots[group * hash_group::SIZE + hash_group::lowest_bit(candidates)];
+        if (node->template priority<is_left>() == hash && table.equal(get<is_left>(node), key))
+          return node;
+      }
+      if (hash_group::match(ctrl, hash_group::EMPTY))
+        return nullptr;
+      group = (group + step) & mask;
+    }
+    return nullptr;
+  }
+
+  // Кладет узел в первый свободный слот на пути его хеша. Место должно быть
+  // подготовлено hash_reserve
+  template <bool is_left>
+  void hash_place(node_ptr node)
+  {
+    auto& table = index_table<is_left>();
+    std::uint32_t hash = node->template priority<is_left>();
+    std::size_t mask = table.group_count - 1;
+    std::size_t group = (hash >> 7) & mask;
+    for (std::size_t step = 1;; step++)
+    {
+      std::uint32_t free = hash_group::match_free(table.ctrl.data() + group * hash_group::SIZE);
+      if (free)
+      {
+        std::size_t slot = group * hash_group::SIZE + hash_group::lowest_bit(free);
+        if (table.ctrl[slot] == hash_group::DELETED)
+          table.deleted_cnt--;
+        table.ctrl[slot] = hash_group::control_byte(hash);
+        table.slots[slot] = node;
+        return;
+      }
+      group = (group + step) & mask;
+    }
+  }
+
+  // Готовит таблицу к count узлам. Если места нет, она перестраивается
+  // заново по сохраненным хешам, заодно выбрасывая удаленные слоты
+  template <bool is_left>
+  void hash_reserve(std::size_t count)
+  {
+    auto& table = index_table<is_left>();
+    if (count + table.deleted_cnt <= hash_group::capacity_limit(table.group_count))
+      return;
+
+    std::size_t groups = hash_group::groups_for(count);
+    std::vector<std::int8_t> ctrl(groups * hash_group::SIZE, hash_group::EMPTY);
+    std::vector<node_ptr> slots(groups * hash_group::SIZE, nullptr);
+    ctrl.swap(table.ctrl);
+    slots.swap(table.slots);
+    table.group_count = groups;
+    table.deleted_cnt = 0;
+    for (std::size_t i = 0; i < ctrl.size(); i++)
+    {
+      if (ctrl[i] >= 0)
+        hash_place<is_left>(slots[i]);
+    }
+  }
+
+  // Слот узла ищется по его хешу и адресу, ключи не сравниваются
+  template <bool is_left>
+  void hash_remove(node_ptr node) noexcept
+  {
+    auto& table = index_table<is_left>();
+    std::uint32_t hash = node->template priority<is_left>();
+    std::int8_t byte = hash_group::control_byte(hash);
+    std::size_t mask = table.group_count - 1;
+    std::size_t group = (hash >> 7) & mask;
+    for (std::size_t step = 1;; step++)
+    {
+      const std::int8_t* ctrl = table.ctrl.data() + group * hash_group::SIZE;
+      for (std::uint32_t candidates = hash_group::match(ctrl, byte); candidates; candidates &= candidates - 1)
+      {
+        std::size_t slot = group * hash_group::SIZE + hash_group::lowest_bit(candidates);
+        if (table.slots[slot] == node)
+        {
+          table.ctrl[slot] = hash_group::DELETED;
+          table.deleted_cnt++;
+          return;
+        }
+      }
+      group = (group + step) & mask;
+    }
+  }
+
+  // Вставляет узлы по порядку, зануляя те, ключ которых уже занят. Если
+  // хеш или сравнение бросят исключение, вставленные узлы вынимаются обратно
+  template <bool is_left>
+  void hash_claim(std::vector<node_ptr>& nodes)
+  {
+    for (node_ptr node : nodes)
+      node->template priority<is_left>() = key_hash<is_left>(get<is_left>(node));
+    hash_reserve<is_left>(node_cnt + nodes.size());
+    std::size_t i = 0;
+    try
+    {
+      for (; i < nodes.size(); i++)
+      {
+        if (hash_find<is_left>(get<is_left>(nodes[i]), nodes[i]->template priority<is_left>()))
+          nodes[i] = nullptr;
+        else
+          hash_place<is_left>(nodes[i]);
+      }
+    }
+    catch (...)
+    {
+      for (std::size_t j = 0; j < i; j++)
+      {
+        if (nodes[j])
+          hash_remove<is_left>(nodes[j]);
+      }
+      throw;
+    }
+  }
+
+  // Дальше - операции над таблицей, для стороны с деревом пустые.
+  // Таблица очищается, сохраняя емкость
+  template <bool is_left>
+  void reset_index()
+  {
+    if constexpr (hashed<is_left>)
+    {
+      auto& table = index_table<is_left>();
+      std::fill(table.ctrl.begin(), table.ctrl.end(), hash_group::EMPTY);
+      table.deleted_cnt = 0;
+    }
+  }
+
+  // У копий те же хеши, поэтому раскладка по слотам копируется как есть, а
+  // указатели переводит relink_index
+  template <bool is_left>
+  void copy_index(const bimap& other)
+  {
+    if constexpr (hashed<is_left>)
+    {
+      auto& table = index_table<is_left>();
+      const auto& source = other.template index_table<is_left>();
+      std::vector<std::int8_t> ctrl(source.ctrl);
+      std::vector<node_ptr> slots(source.slots.size(), nullptr);
+      table.ctrl.swap(ctrl);
+      table.slots.swap(slots);
+      table.group_count = source.group_count;
+      table.deleted_cnt = source.deleted_cnt;
+    }
+  }
+
+  template <bool is_left>
+  void relink_index(const bimap& other, const node_map& copies)
+  {
+    if constexpr (hashed<is_left>)
+    {
+      auto& table = index_table<is_left>();
+      const auto& source = other.template index_table<is_left>();
+      for (std::size_t i = 0; i < table.ctrl.size(); i++)
+      {
+        if (table.ctrl[i] >= 0)
+          table.slots[i] = copies.find(source.slots[i]);
+      }
+    }
+  }
+
+  // Оставляет из каждой серии равных ключей только первый узел
+  template <typename Less>
+  static void drop_repeats(std::vector<node_ptr>& nodes, Less less)
+  {
+    if (nodes.empty())
+      return;
+    std::size_t kept = 1;
+    for (std::size_t i = 1; i < nodes.size(); i++)
+    {
+      if (less(nodes[kept - 1], nodes[i]))
+        nodes[kept++] = nodes[i];
+    }
+    nodes.resize(kept);
+  }
+
+  // Декартово дерево по узлам, уже упорядоченным по ключу стороны, за
+  // линейное время: в стеке лежит правый край дерева, новый узел забирает
+  // себе в левые сыновья все узлы края с меньшим приоритетом. Снятый со
+  // стека узел уже не меняется, тогда и пересчитывается его поддерево
+  template <bool is_left>
+  static node_ptr build_cartesian(const std::vector<node_ptr>& nodes, std::vector<node_ptr>& stack)
+  {
+    stack.clear();
+    for (node_ptr node : nodes)
+    {
+      node_ptr last = nullptr;
+      while (!stack.empty() && stack.back()->template priority<is_left>() < node->template priority<is_left>())
+      {
+        last = stack.back();
+        pull<is_left>(last);
+        stack.pop_back();
+      }
+      node->template attach_left<is_left>(last);
+      if (!stack.empty())
+        stack.back()->template attach_right<is_left>(node);
+      stack.push_back(node);
+    }
+    for (auto it = stack.rbegin(); it != stack.rend(); ++it)
+      pull<is_left>(*it);
+    return stack.empty() ? nullptr : stack.front();
+  }
+
+  void recalc() const
+  {
+    left_pair.pointer = Node::template minimum<order_side<true>>(root_pair.pointer);
+    right_pair.pointer = Node::template minimum<order_side<false>>(root_pair.pointer);
+    is_changed = false;
+  }
+
+  template <typename Cmp, typename = void>
+  struct is_transparent : std::false_type {};
+  template <typename Cmp>
+  struct is_transparent<Cmp, std::void_t<typename Cmp::is_transparent>> : std::true_type {};
+
+  // Ключ для сравнений: как есть для прозрачного компаратора, иначе один
+  // раз приведенный к типу ключей стороны
+  template <bool is_left, typename K>
+  static decltype(auto) side_key(const K& key)
+  {
+    if constexpr (is_transparent<cmp_type<is_left>>::value || std::is_same_v<K, val_type<is_left>>)
+      return (key);
+    else
+      return val_type<is_left>(key);
+  }
+
+  template <bool is_left>
+  static std::size_t subtree_size(node_ptr node)
+  {
+    return node ? static_cast<Val_node*>(node)->template size<is_left>() : 0;
+  }
+
+  template <bool is_left, typename M = Monoid>
+  static typename M::value_type subtree_aggregate(node_ptr node)
+  {
+    return node ? static_cast<Val_node*>(node)->template aggregate<is_left>() : M().identity();
+  }
+
+  template <typename M = Monoid>
+  static typename M::value_type lift(node_ptr node)
+  {
+    Val_node* val = static_cast<Val_node*>(node);
+    return M().lift(val->left_val, val->right_val);
+  }
+
+  // Пересчитывает размер (и значение моноида) узла по его сыновьям
+  template <bool is_left>
+  static void pull(node_ptr node)
+  {
+    node_ptr l = node->template go_left<is_left>();
+    node_ptr r = node->template go_right<is_left>();
+    Val_node* val = static_cast<Val_node*>(node);
+    val->template size<is_left>() = static_cast<std::uint32_t>(1 + subtree_size<is_left>(l) + subtree_size<is_left>(r));
+    if constexpr (has_monoid)
+    {
+      Monoid monoid;
+      val->template aggregate<is_left>() = monoid.combine(monoid.combine(subtree_aggregate<is_left>(l), lift(node)),
+        subtree_aggregate<is_left>(r));
+    }
+  }
+
+  // Пересчитывает узлы от node вверх по родителям до top включительно
+  template <bool is_left>
+  static void pull_path(node_ptr node, node_ptr top)
+  {
+    while (true)
+    {
+      pull<is_left>(node);
+      if (node == top)
+        break;
+      node = node->template parent<is_left>();
+    }
+  }
+
+  static void copy_augmentation(node_ptr from, node_ptr to)
+  {
+    Val_node* src = static_cast<Val_node*>(from);
+    Val_node* dst = static_cast<Val_node*>(to);
+    dst->left_size = src->left_size;
+    dst->right_size = src->right_size;
+    if constexpr (has_monoid)
+    {
+      dst->left_agg = src->left_agg;
+      dst->right_agg = src->right_agg;
+    }
+  }
+
+  // Число ключей стороны, меньших key
+  template <bool is_left, typename K>
+  std::size_t rank(const K& key) const
+  {
+    static_assert(!hashed<is_left>, "Ordered queries need an ordered index on this side");
+    const cmp_type<is_left>& cmp = compare<is_left>();
+    std::size_t res = 0;
+    node_ptr curr = root_pair.pointer->template go_left<is_left>();
+    while (curr)
+    {
+      if (cmp(get<is_left>(curr), key))
+      {
+        res += subtree_size<is_left>(curr->template go_left<is_left>()) + 1;
+        curr = curr->template go_right<is_left>();
+      }
+      else
+        curr = curr->template go_left<is_left>();
+    }
+    return res;
+  }
+
+  template <bool is_left>
+  node_ptr nth(std::size_t index) const
+  {
+    static_assert(!hashed<is_left>, "Ordered queries need an ordered index on this side");
+    if (index >= node_cnt)
+      return root_pair.pointer;
+    node_ptr curr = root_pair.pointer->template go_left<is_left>();
+    while (true)
+    {
+      std::size_t left_size = subtree_size<is_left>(curr->template go_left<is_left>());
+      if (index < left_size)
+        curr = curr->template go_left<is_left>();
+      else if (index == left_size)
+        return curr;
+      else
+      {
+        index -= left_size + 1;
+        curr = curr->template go_right<is_left>();
+      }
+    }
+  }
+
+  // Номер узла в порядке стороны, для end - size()
+  template <bool is_left>
+  std::size_t position(node_ptr node) const
+  {
+    static_assert(!hashed<is_left>, "Ordered queries need an ordered index on this side");
+    if (node == root_pair.pointer)
+      return node_cnt;
+    std::size_t res = subtree_size<is_left>(node->template go_left<is_left>());
+    for (node_ptr par = node->template parent<is_left>(); par != root_pair.pointer;
+      node = par, par = par->template parent<is_left>())
+    {
+      if (node == par->template go_right<is_left>())
+        res += subtree_size<is_left>(par->template go_left<is_left>()) + 1;
+    }
+    return res;
+  }
+
+  // Свертка моноида по ключам стороны из [from, to) в порядке ключей: спуск
+  // до первого узла внутри диапазона, затем по суффиксу его левого и
+  // префиксу его правого поддерева
+  template <bool is_left, typename K1, typename K2, typename M = Monoid>
+  typename M::value_type aggregate(const K1& from, const K2& to) const
+  {
+    static_assert(!hashed<is_left>, "Ordered queries need an ordered index on this side");
+    const cmp_type<is_left>& cmp = compare<is_left>();
+    M monoid;
+    node_ptr curr = root_pair.pointer->template go_left<is_left>();
+    while (curr)
+    {
+      if (cmp(get<is_left>(curr), from))
+        curr = curr->template go_right<is_left>();
+      else if (!cmp(get<is_left>(curr), to))
+        curr = curr->template go_left<is_left>();
+      else
+        break;
+    }
+    if (!curr)
+      return monoid.identity();
+
+    typename M::value_type suffix = monoid.identity();
+    for (node_ptr t = curr->template go_left<is_left>(); t;)
+    {
+      if (cmp(get<is_left>(t), from))
+        t = t->template go_right<is_left>();
+      else
+      {
+        suffix = monoid.combine(monoid.combine(lift(t), subtree_aggregate<is_left>(t->template go_right<is_left>())), suffix);
+        t = t->template go_left<is_left>();
+      }
+    }
+    typename M::value_type prefix = monoid.identity();
+    for (node_ptr t = curr->template go_right<is_left>(); t;)
+    {
+      if (cmp(get<is_left>(t), to))
+      {
+        prefix = monoid.combine(prefix, monoid.combine(subtree_aggregate<is_left>(t->template go_left<is_left>()), lift(t)));
+        t = t->template go_right<is_left>();
+      }
+      else
+        t = t->template go_left<is_left>();
+    }
+    return monoid.combine(monoid.combine(suffix, lift(curr)), prefix);
+  }
+
+  // Спуск сверху вниз: узлы с ключом меньше key по очереди подвешиваются
+  // правыми сыновьями к последнему узлу левой части, остальные - левыми
+  // сыновьями к последнему узлу правой части. Форма частей та же, что и у
+  // рекурсивного разреза, а стек не зависит от глубины дерева
+  template <bool is_left>
+  std::pair<node_ptr, node_ptr> split(node_ptr t, const val_type<is_left>& key, const cmp_type<is_left>& cmp)
+  {
+    node_ptr less_root = nullptr, less_last = nullptr;
+    node_ptr greater_root = nullptr, greater_last = nullptr;
+    while (t)
+    {
+      if (cmp(get<is_left>(t), key))
+      {
+        if (less_last)
+          less_last->template attach_right<is_left>(t);
+        else
+          less_root = t;
+        less_last = t;
+        t = t->template go_right<is_left>();
+      }
+      else
+      {
+        if (greater_last)
+          greater_last->template attach_left<is_left>(t);
+        else
+          greater_root = t;
+        greater_last = t;
+        t = t->template go_left<is_left>();
+      }
+    }
+    if (less_last)
+    {
+      less_last->template attach_right<is_left>(nullptr);
+      pull_path<is_left>(less_last, less_root);
+    }
+    if (greater_last)
+    {
+      greater_last->template attach_left<is_left>(nullptr);
+      pull_path<is_left>(greater_last, greater_root);
+    }
+    return { less_root, greater_root };
+  }
+
+  // Все ключи t1 меньше всех ключей t2. Форму дерева задают только
+  // случайные приоритеты своей стороны, поэтому глубина логарифмическая
+  // в среднем, как бы ни были связаны левые и правые ключи
+  // Сливаются правый край t1 и левый край t2: на каждом шаге узел с большим
+  // приоритетом подвешивается к предыдущему с той стороны, откуда пришел
+  template <bool is_left>
+  node_ptr merge(node_ptr t1, node_ptr t2)
+  {
+    node_ptr res = nullptr, last = nullptr;
+    bool last_from_t1 = false;
+    while (t1 && t2)
+    {
+      node_ptr next;
+      bool from_t1 = t1->template priority<is_left>() > t2->template priority<is_left>();
+      if (from_t1)
+      {
+        next = t1;
+        t1 = t1->template go_right<is_left>();
+      }
+      else
+      {
+        next = t2;
+        t2 = t2->template go_left<is_left>();
+      }
+      hang<is_left>(res, last, last_from_t1, next);
+      last = next;
+      last_from_t1 = from_t1;
+    }
+    hang<is_left>(res, last, last_from_t1, t1 ? t1 : t2);
+    if (last)
+      pull_path<is_left>(last, res);
+    return res;
+  }
+
+  template <bool is_left>
+  static void hang(node_ptr& res, node_ptr last, bool last_from_t1, node_ptr node)
+  {
+    if (!last)
+      res = node;
+    else if (last_from_t1)
+      last->template attach_right<is_left>(node);
+    else
+      last->template attach_left<is_left>(node);
+  }
+
+  template <bool is_left, typename K>
+  val_type<!is_left> const& at(K const& key) const
+  {
+    node_ptr temp_it = find_node<is_left>(key, compare<is_left>());
+    if (!temp_it)
+    {
+      throw std::out_of_range("element with given key doesn't exist");
+    }
+    return get<!is_left>(temp_it);
+  }
+
+  template <bool is_left, typename K> bool erase(K const& key)
+  {
+    node_ptr node = find_node<is_left>(key, compare<is_left>());
+    if (!node)
+      return false;
+    erase_left(left_iterator(node));
+    return true;
+  }
+
+  template <bool is_left>
+  iterator<is_left> erase(iterator<is_left> first, iterator<is_left> last)
+  {
+    // Хешированная сторона обходится в порядке другой, там и режется
+    if constexpr (hashed<is_left>)
+      return erase<!is_left>(first.flip(), last.flip()).flip();
+    else
+    {
+      if (first == last)
+        return last;
+
+      node_ptr root = root_pair.pointer;
+      std::pair<node_ptr, node_ptr> head = split<is_left>(root->template go_left<is_left>(),
+        get<is_left>(first.ptr), compare<is_left>());
+      std::pair<node_ptr, node_ptr> tail(head.second, nullptr);
+      if (last.ptr != root)
+        tail = split<is_left>(head.second, get<is_left>(last.ptr), compare<is_left>());
+      root->template attach_left<is_left>(merge<is_left>(head.first, tail.second));
+
+      node_cnt -= erase_subtree<is_left>(tail.first);
+      is_changed = true;
+      return last;
+    }
+  }
+
+  // Вынимает узел из индекса стороны is_left. Из дерева - подвешивая на
+  // его место слияние его сыновей и пересчитывая путь до корня
+  template <bool is_left>
+  void unlink(node_ptr node)
+  {
+    if constexpr (hashed<is_left>)
+      hash_remove<is_left>(node);
+    else
+    {
+      node_ptr par = node->template parent<is_left>();
+      node_ptr merged = merge<is_left>(node->template go_left<is_left>(), node->template go_right<is_left>());
+      if (node == par->template go_left<is_left>())
+        par->template attach_left<is_left>(merged);
+      else
+        par->template attach_right<is_left>(merged);
+      if constexpr (has_monoid)
+      {
+        if (par != root_pair.pointer)
+          pull_path<is_left>(par, root_pair.pointer->template go_left<is_left>());
+      }
+      else
+      {
+        for (; par != root_pair.pointer; par = par->template parent<is_left>())
+          static_cast<Val_node*>(par)->template size<is_left>()--;
+      }
+    }
+  }
+
+  // Удаляет вырезанное поддерево стороны is_left вместе с его узлами в
+  // дереве другой стороны. Если пачка занимает хотя бы 1/BATCH_SHARE всех
+  // пар, узлы вынимаются оттуда слиянием сыновей, а размеры и моноид
+  // предков пересчитываются один раз на всю пачку: каждый предок - однажды,
+  // после своих сыновей, всего O(k log(n/k)) = O(k) в среднем. Меньшие пачки
+  // дешевле вынимать по одному с проходом до корня, O(k log n): верхние
+  // узлы этих путей общие и лежат в кеше, а пересчету нужны оба сына
+  // каждого предка
+  static constexpr std::size_t BATCH_SHARE = 16;
+
+  template <bool is_left>
+  std::size_t erase_subtree(node_ptr t)
+  {
+    if constexpr (hashed<!is_left>)
+      return destroy_subtree<is_left>(t, true);
+    else
+    {
+      if (subtree_size<is_left>(t) * BATCH_SHARE < node_cnt)
+        return destroy_subtree<is_left>(t, true);
+
+      // Обход поворотами, как в destroy_subtree, но без освобождения: узлы
+      // выстраиваются в цепочку по правым сыновьям, начиная с head
+      node_ptr head = nullptr;
+      node_ptr tail = nullptr;
+      while (t)
+      {
+        node_ptr l = t->template go_left<is_left>();
+        if (l)
+        {
+          t->template attach_left<is_left>(l->template go_right<is_left>());
+          l->template attach_right<is_left>(t);
+          if (tail)
+            tail->template attach_right<is_left>(l);
+          t = l;
+        }
+        else
+        {
+          detach<!is_left>(t);
+          if (!head)
+            head = t;
+          tail = t;
+          t = t->template go_right<is_left>();
+        }
+      }
+
+      for (node_ptr curr = head; curr; curr = curr->template go_right<is_left>())
+        mark_path<!is_left>(curr->template parent<!is_left>());
+      pull_marked<!is_left>();
+
+      std::size_t count = 0;
+      while (head)
+      {
+        node_ptr next = head->template go_right<is_left>();
+        destroy_node(head);
+        count++;
+        head = next;
+      }
+      return count;
+    }
+  }
+
+  // Вынимает узел из дерева стороны is_left, не трогая предков. Ссылка на
+  // прежнего отца остается, но отец больше не считает узел сыном
+  template <bool is_left>
+  void detach(node_ptr node)
+  {
+    node_ptr par = node->template parent<is_left>();
+    node_ptr merged = merge<is_left>(node->template go_left<is_left>(), node->template go_right<is_left>());
+    if (node == par->template go_left<is_left>())
+      par->template attach_left<is_left>(merged);
+    else
+      par->template attach_right<is_left>(merged);
+    node->template attach_left<is_left>(nullptr);
+    node->template attach_right<is_left>(nullptr);
+  }
+
+  template <bool is_left>
+  bool is_detached(node_ptr node) const
+  {
+    if (node == root_pair.pointer)
+      return false;
+    node_ptr par = node->template parent<is_left>();
+    return par->template go_left<is_left>() != node && par->template go_right<is_left>() != node;
+  }
+
+  // Помечает нулевым размером узлы от node до корня, которые еще не
+  // помечены. Вынутые узлы пропускаются: их отец уже не их предок, а отца
+  // того места, куда ушли их сыновья, пометит сам вынутый узел
+  template <bool is_left>
+  void mark_path(node_ptr node)
+  {
+    if (is_detached<is_left>(node))
+      return;
+    for (; node != root_pair.pointer; node = node->template parent<is_left>())
+    {
+      std::uint32_t& size = static_cast<Val_node*>(node)->template size<is_left>();
+      if (size == 0)
+        break;
+      size = 0;
+    }
+  }
+
+  // Пересчитывает помеченные узлы сыновьями вперед. Помеченные узлы
+  // образуют поддерево с корнем в корне дерева, и обход спускается в
+  // помеченного сына, пока он есть, а иначе пересчитывает узел (это снимает
+  // пометку) и поднимается к отцу
+  template <bool is_left>
+  void pull_marked()
+  {
+    node_ptr curr = root_pair.pointer->template go_left<is_left>();
+    if (!curr || static_cast<Val_node*>(curr)->template size<is_left>() != 0)
+      return;
+    while (curr != root_pair.pointer)
+    {
+      node_ptr l = curr->template go_left<is_left>();
+      node_ptr r = curr->template go_right<is_left>();
+      if (l && static_cast<Val_node*>(l)->template size<is_left>() == 0)
+        curr = l;
+      else if (r && static_cast<Val_node*>(r)->template size<is_left>() == 0)
+        curr = r;
+      else
+      {
+        pull<is_left>(curr);
+        curr = curr->template parent<is_left>();
+      }
+    }
+  }
+
+  // Освобождает поддерево стороны is_left за линейное время без стека:
+  // пока у узла есть левый сын, дерево поворачивается направо, иначе узел
+  // освобождается и обход уходит в правого сына. С unlink_other каждый узел
+  // перед этим вынимается из дерева другой стороны. Возвращает число узлов
+  template <bool is_left>
+  std::size_t destroy_subtree(node_ptr t, bool unlink_other)
+  {
+    std::size_t count = 0;
+    while (t)
+    {
+      node_ptr l = t->template go_left<is_left>();
+      if (l)
+      {
+        t->template attach_left<is_left>(l->template go_right<is_left>());
+        l->template attach_right<is_left>(t);
+        t = l;
+      }
+      else
+      {
+        node_ptr r = t->template go_right<is_left>();
+        if (unlink_other)
+          unlink<!is_left>(t);
+        destroy_node(t);
+        count++;
+        t = r;
+      }
+    }
+    return count;
+  }
+
+  template <bool is_left, typename K>
+  iterator<is_left> lower_bound(const K& key, const cmp_type<is_left>& cmp) const
+  {
+    static_assert(!hashed<is_left>, "Ordered queries need an ordered index on this side");
+    node_ptr curr = root_pair.pointer->template go_left<is_left>();
+    node_ptr res = nullptr;
+    while (curr)
+    {
+      if (cmp(get<is_left>(curr), key))
+      {
+        curr = curr->template go_right<is_left>();
+      }
+      else
+      {
+        res = curr;
+        curr = curr->template go_left<is_left>();
+      }
+    }
+
+    if (res) 
+      return iterator<is_left>(res); 
+    else if constexpr (is_left)
+      return end_left(); 
+    else 
+      return end_right();
+  }
+
+  template <bool is_left, typename K>
+  iterator<is_left> upper_bound(const K& key, const cmp_type<is_left>& cmp) const
+  {
+    static_assert(!hashed<is_left>, "Ordered queries need an ordered index on this side");
+    node_ptr curr = root_pair.pointer->template go_left<is_left>();
+    node_ptr res = nullptr;
+    while (curr)
+    {
+      if (cmp(key, get<is_left>(curr)))
+      {
+        res = curr;
+        curr = curr->template go_left<is_left>();
+      }
+      else
+      {
+        curr = curr->template go_right<is_left>();
+      }
+    }
+
     if (res) 
       return iterator<is_left>(res);
     else if constexpr (is_left) 
@@ -710,8 +1933,8 @@ private:
 };
 
 template <typename Left, typename Right, typename CompareLeft,
-  typename CompareRight>
-  class bimap<Left, Right, CompareLeft, CompareRight>::Node
+  typename CompareRight, typename Allocator, typename Monoid>
+  class bimap<Left, Right, CompareLeft, CompareRight, Allocator, Monoid>::Node
 {
   friend class bimap;
   class Tree_node;
@@ -720,22 +1943,46 @@ template <typename Left, typename Right, typename CompareLeft,
   using left_t = Left;
   using right_t = Right;
 
-  Tree_node left_node;
-  Tree_node right_node;
+  // У хешированной стороны нет дерева, и ссылки ей не нужны
+  struct no_links {};
+  template <bool is_left>
+  using side_links = std::conditional_t<is_left ? hashed_left : hashed_right, no_links, Tree_node>;
+
+  // Узел не хранит ни vptr, ни указателей на владельца: Val_node всегда
+  // удаляется через свой собственный тип, а владелец Tree_node находится
+  // по смещению поля, поэтому на пару уходит 64 байта служебных данных
+  // (48, если одна из сторон хеширована)
+  side_links<true> left_node;
+  side_links<false> right_node;
+  // У каждой стороны свой приоритет: иначе при монотонно связанных ключах
+  // куча по одной стороне совпадает с порядком другой и дерево вырождается.
+  // Хешированная сторона хранит здесь хеш ключа
+  std::uint32_t left_priority;
+  std::uint32_t right_priority;
+
+  static std::uint32_t random_priority()
+  {
+    thread_local std::mt19937 generator(std::random_device{}());
+    return static_cast<std::uint32_t>(generator());
+  }
 
-  static node_ptr safe_ret_owner(tree_node_ptr node)
+  template <bool is_left> static node_ptr safe_ret_owner(tree_node_ptr node)
   {
-    return node ? node->owner : nullptr;
+    static_assert(std::is_standard_layout_v<Node>, "Owner is found by the offset of the tree node");
+    if (!node)
+      return nullptr;
+    std::size_t offset = is_left ? offsetof(Node, left_node) : offsetof(Node, right_node);
+    return reinterpret_cast<node_ptr>(reinterpret_cast<char*>(node) - offset);
   }
 
 public:
-  Node() 
-    : left_node(this)
-    , right_node(this) 
+  Node()
+    : left_node()
+    , right_node()
+    , left_priority(hashed_left ? 0 : random_priority())
+    , right_priority(hashed_right ? 0 : random_priority())
   {}
 
-  virtual ~Node() {}
-
   template <bool is_left> tree_node_ptr get_tree_node()
   {
     if constexpr (is_left)
@@ -744,22 +1991,30 @@ public:
       return &right_node;
   }
 
+  template <bool is_left> std::uint32_t& priority()
+  {
+    if constexpr (is_left)
+      return left_priority;
+    else
+      return right_priority;
+  }
+
   template <bool is_left> node_ptr parent()
   {
     tree_node_ptr p = get_tree_node<is_left>()->go_parent();
-    return safe_ret_owner(p);
+    return safe_ret_owner<is_left>(p);
   }
 
   template <bool is_left> node_ptr go_right()
   {
     tree_node_ptr p = get_tree_node<is_left>()->go_right();
-    return safe_ret_owner(p);
+    return safe_ret_owner<is_left>(p);
   }
 
   template <bool is_left> node_ptr go_left()
   {
     tree_node_ptr p = get_tree_node<is_left>()->go_left();
-    return safe_ret_owner(p);
+    return safe_ret_owner<is_left>(p);
   }
 
   template <bool is_left> void attach_left(node_ptr node)
@@ -773,22 +2028,12 @@ public:
     get_tree_node<is_left>()->attach_right(to_attach);
   }
 
-  void nullify()
-  {
-    left_node.left = nullptr;
-    left_node.right = nullptr;
-    left_node.parent = nullptr;
-    right_node.left = nullptr;
-    right_node.right = nullptr;
-    right_node.parent = nullptr;
-  }
-
   template <bool is_left> static node_ptr next(node_ptr curr)
   {
     if (!curr) { return nullptr; }
 
     tree_node_ptr temp = Tree_node::next(curr->template get_tree_node<is_left>());
-    return safe_ret_owner(temp);
+    return safe_ret_owner<is_left>(temp);
   }
 
   template <bool is_left> static node_ptr prev(node_ptr curr)
@@ -796,58 +2041,89 @@ public:
     if (!curr) { return nullptr; }
 
     tree_node_ptr temp = Tree_node::prev(curr->template get_tree_node<is_left>());
-    return safe_ret_owner(temp);
+    return safe_ret_owner<is_left>(temp);
   }
 
   template <bool is_left> static node_ptr minimum(node_ptr curr)
   {
-    return Tree_node::minimum(curr->template get_tree_node<is_left>())->owner;
+    return safe_ret_owner<is_left>(Tree_node::minimum(curr->template get_tree_node<is_left>()));
   }
 
   template <bool is_left> static node_ptr maximum(node_ptr curr)
   {
-    return Tree_node::maximum(curr->template get_tree_node<is_left>())->owner;
+    return safe_ret_owner<is_left>(Tree_node::maximum(curr->template get_tree_node<is_left>()));
   }
 };
 
 template <typename Left, typename Right, typename CompareLeft,
-  typename CompareRight>
-  class bimap<Left, Right, CompareLeft, CompareRight>::Val_node
-  : public bimap<Left, Right, CompareLeft, CompareRight>::Node
+  typename CompareRight, typename Allocator, typename Monoid>
+  class bimap<Left, Right, CompareLeft, CompareRight, Allocator, Monoid>::Val_node
+  : public bimap<Left, Right, CompareLeft, CompareRight, Allocator, Monoid>::Node
+  , public bimap<Left, Right, CompareLeft, CompareRight, Allocator, Monoid>::aggregate_base
 {
   friend class bimap;
   using left_t = Left;
   using right_t = Right;
 
+  // Размеры поддеревьев по каждой стороне
+  std::uint32_t left_size;
+  std::uint32_t right_size;
   left_t left_val;
   right_t right_val;
 
+  template <bool is_left> std::uint32_t& size()
+  {
+    if constexpr (is_left)
+      return left_size;
+    else
+      return right_size;
+  }
+
+  template <bool is_left> auto& aggregate()
+  {
+    if constexpr (is_left)
+      return this->left_agg;
+    else
+      return this->right_agg;
+  }
+
+  void init_aggregates()
+  {
+    if constexpr (has_monoid)
+      this->left_agg = this->right_agg = Monoid().lift(left_val, right_val);
+  }
+
 public:
   Val_node(const left_t& l_value, const right_t& r_value)
-    : Node(), left_val(l_value), right_val(r_value)
-  {}
+    : Node(), left_size(1), right_size(1), left_val(l_value), right_val(r_value)
+  {
+    init_aggregates();
+  }
   Val_node(left_t&& l_value, const right_t& r_value)
-    : Node(), left_val(std::move(l_value)), right_val(r_value)
-  {}
+    : Node(), left_size(1), right_size(1), left_val(std::move(l_value)), right_val(r_value)
+  {
+    init_aggregates();
+  }
   Val_node(const left_t& l_value, right_t&& r_value)
-    : Node(), left_val(l_value), right_val(std::move(r_value))
-  {}
+    : Node(), left_size(1), right_size(1), left_val(l_value), right_val(std::move(r_value))
+  {
+    init_aggregates();
+  }
   Val_node(left_t&& l_value, right_t&& r_value)
-    : Node(), left_val(std::move(l_value)), right_val(std::move(r_value))
-  {}
-
-  ~Val_node() {}
+    : Node(), left_size(1), right_size(1), left_val(std::move(l_value)), right_val(std::move(r_value))
+  {
+    init_aggregates();
+  }
 };
 
 template <typename Left, typename Right, typename CompareLeft,
-  typename CompareRight>
-  class bimap<Left, Right, CompareLeft, CompareRight>::Node::Tree_node
+  typename CompareRight, typename Allocator, typename Monoid>
+  class bimap<Left, Right, CompareLeft, CompareRight, Allocator, Monoid>::Node::Tree_node
 {
   friend Node;
   using node_ptr = Node *;
   using tree_node_ptr = Tree_node *;
   tree_node_ptr left, right, parent;
-  node_ptr owner;
 
   tree_node_ptr go_parent() { return parent; }
   tree_node_ptr go_right() { return right; }
@@ -927,10 +2203,9 @@ template <typename Left, typename Right, typename CompareLeft,
   }
 
 public:
-  Tree_node(node_ptr owner)
+  Tree_node()
     : left(nullptr)
     , right(nullptr)
     , parent(nullptr)
-    , owner(owner)
   {}
 };
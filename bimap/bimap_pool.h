@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+// Пул памяти для узлов bimap. Память берется у системы слэбами, внутри
+// слэба блоки одного размерного класса выдаются подряд, поэтому узлы,
+// вставленные друг за другом, лежат рядом. Освобожденные блоки попадают в
+// односвязный список своего класса и выдаются повторно раньше новых.
+// Блоки крупнее последнего класса берутся у operator new по одному и
+// держатся в двусвязном списке, чтобы release() вернул и их
+class bimap_pool
+{
+public:
+  static constexpr std::size_t GRANULE = alignof(std::max_align_t);
+  static constexpr std::size_t CLASS_COUNT = 16;
+  static constexpr std::size_t SLAB_SIZE = 64 * 1024;
+
+  bimap_pool() = default;
+  bimap_pool(const bimap_pool&) = delete;
+  bimap_pool& operator=(const bimap_pool&) = delete;
+
+  ~bimap_pool() { release(); }
+
+  void* allocate(std::size_t bytes)
+  {
+    std::size_t index = size_class(bytes);
+    if (index >= CLASS_COUNT)
+      return allocate_large(bytes);
+
+    free_list& list = classes[index];
+    if (list.head)
+    {
+      free_block* block = list.head;
+      list.head = block->next;
+      return block;
+    }
+
+    std::size_t block_size = (index + 1) * GRANULE;
+    if (list.cursor + block_size > list.end)
+      grow(list);
+    void* res = list.cursor;
+    list.cursor += block_size;
+    return res;
+  }
+
+  void deallocate(void* ptr, std::size_t bytes) noexcept
+  {
+    std::size_t index = size_class(bytes);
+    if (index >= CLASS_COUNT)
+    {
+      deallocate_large(ptr);
+      return;
+    }
+
+    free_block* block = static_cast<free_block*>(ptr);
+    block->next = classes[index].head;
+    classes[index].head = block;
+  }
+
+  // Возвращает системе все слэбы и крупные блоки разом. Выданные блоки
+  // становятся недействительными, деструкторы лежащих в них объектов не
+  // вызываются
+  void release() noexcept
+  {
+    while (slabs)
+    {
+      slab_header* next = slabs->next;
+      ::operator delete(slabs);
+      slabs = next;
+    }
+    while (large)
+    {
+      large_header* next = large->next;
+      ::operator delete(large);
+      large = next;
+    }
+    for (free_list& list : classes)
+      list = free_list();
+  }
+
+private:
+  struct free_block
+  {
+    free_block* next;
+  };
+
+  struct alignas(GRANULE) slab_header
+  {
+    slab_header* next;
+  };
+
+  struct alignas(GRANULE) large_header
+  {
+    large_header* prev;
+    large_header* next;
+  };
+
+  struct free_list
+  {
+    free_block* head = nullptr;
+    char* cursor = nullptr;
+    char* end = nullptr;
+  };
+
+  free_list classes[CLASS_COUNT];
+  slab_header* slabs = nullptr;
+  large_header* large = nullptr;
+
+  static std::size_t size_class(std::size_t bytes)
+  {
+    return bytes == 0 ? 0 : (bytes - 1) / GRANULE;
+  }
+
+  void grow(free_list& list)
+  {
+    slab_header* slab = static_cast<slab_header*>(::operator new(SLAB_SIZE));
+    slab->next = slabs;
+    slabs = slab;
+    list.cursor = reinterpret_cast<char*>(slab + 1);
+    list.end = reinterpret_cast<char*>(slab) + SLAB_SIZE;
+  }
+
+  // Заголовок крупного блока лежит прямо перед выданной памятью
+  void* allocate_large(std::size_t bytes)
+  {
+    large_header* block = static_cast<large_header*>(::operator new(sizeof(large_header) + bytes));
+    block->prev = nullptr;
+    block->next = large;
+    if (large)
+      large->prev = block;
+    large = block;
+    return block + 1;
+  }
+
+  void deallocate_large(void* ptr) noexcept
+  {
+    large_header* block = static_cast<large_header*>(ptr) - 1;
+    if (block->prev)
+      block->prev->next = block->next;
+    else
+      large = block->next;
+    if (block->next)
+      block->next->prev = block->prev;
+    ::operator delete(block);
+  }
+};
+
+// Аллокатор поверх bimap_pool. Копии и rebind-копии делят один пул, а
+// копия контейнера получает свой собственный (см.
+// select_on_container_copy_construction), поэтому bimap, который
+// единолично владеет пулом, может в clear() вернуть его слэбы целиком
+template <typename T>
+class bimap_pool_allocator
+{
+  static_assert(alignof(T) <= bimap_pool::GRANULE, "Overaligned types are not supported by bimap_pool");
+
+  template <typename U> friend class bimap_pool_allocator;
+
+public:
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+  using is_always_equal = std::false_type;
+
+  bimap_pool_allocator()
+    : pool(std::make_shared<bimap_pool>())
+  {}
+
+  template <typename U>
+  bimap_pool_allocator(const bimap_pool_allocator<U>& other) noexcept
+    : pool(other.pool)
+  {}
+
+  T* allocate(std::size_t n)
+  {
+    return static_cast<T*>(pool->allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* ptr, std::size_t n) noexcept
+  {
+    pool->deallocate(ptr, n * sizeof(T));
+  }
+
+  bimap_pool_allocator select_on_container_copy_construction() const
+  {
+    return bimap_pool_allocator();
+  }
+
+  // Пулом не пользуется никто, кроме этого аллокатора
+  bool owns_pool() const { return pool.use_count() == 1; }
+
+  void release() noexcept { pool->release(); }
+
+  friend bool operator==(const bimap_pool_allocator& a, const bimap_pool_allocator& b)
+  {
+    return a.pool == b.pool;
+  }
+  friend bool operator!=(const bimap_pool_allocator& a, const bimap_pool_allocator& b)
+  {
+    return !(a == b);
+  }
+
+private:
+  std::shared_ptr<bimap_pool> pool;
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Группа из 16 управляющих байт хеш-таблицы с открытой адресацией: у
+// свободного слота байт отрицателен (EMPTY или DELETED), у занятого это
+// младшие 7 бит хеша ключа. Группа сравнивается целиком одной SSE2-командой,
+// без SSE2 - обычным циклом. Общая часть unordered_bimap и хешированной
+// стороны bimap
+struct hash_group
+{
+  static constexpr std::size_t SIZE = 16;
+  static constexpr std::int8_t EMPTY = -128;
+  static constexpr std::int8_t DELETED = -2;
+
+  // Биты слотов группы, управляющий байт которых равен byte
+  static std::uint32_t match(const std::int8_t* group, std::int8_t byte)
+  {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(byte))));
+#else
+    std::uint32_t res = 0;
+    for (std::size_t i = 0; i < SIZE; i++)
+    {
+      if (group[i] == byte)
+        res |= 1u << i;
+    }
+    return res;
+#endif
+  }
+
+  // Биты пустых и удаленных слотов группы: у них старший бит байта единица
+  static std::uint32_t match_free(const std::int8_t* group)
+  {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return static_cast<std::uint32_t>(_mm_movemask_epi8(ctrl));
+#else
+    std::uint32_t res = 0;
+    for (std::size_t i = 0; i < SIZE; i++)
+    {
+      if (group[i] < 0)
+        res |= 1u << i;
+    }
+    return res;
+#endif
+  }
+
+  static unsigned lowest_bit(std::uint32_t mask)
+  {
+    return static_cast<unsigned>(__builtin_ctz(mask));
+  }
+
+  // std::hash для целых - тождественная функция, поэтому хеш перемешивается:
+  // младшие 7 бит идут в управляющий байт, остальные выбирают группу
+  static std::size_t mix(std::uint64_t hash)
+  {
+    hash *= 0x9E3779B97F4A7C15ull;
+    return static_cast<std::size_t>(hash ^ (hash >> 32));
+  }
+
+  static std::int8_t control_byte(std::size_t hash) { return static_cast<std::int8_t>(hash & 0x7F); }
+
+  // Заполнение не больше 7/8, удаленные слоты тоже считаются занятыми
+  static std::size_t capacity_limit(std::size_t groups)
+  {
+    return groups * SIZE / 8 * 7;
+  }
+
+  // Число групп (степень двойки) под count ключей. Группы перебираются с
+  // треугольным шагом, и такой обход посещает каждую группу ровно один раз
+  static std::size_t groups_for(std::size_t count)
+  {
+    std::size_t groups = 1;
+    while (capacity_limit(groups) < count)
+      groups *= 2;
+    return groups;
+  }
+};
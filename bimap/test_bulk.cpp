@@ -0,0 +1,191 @@
+// Сверка insert_bulk и assign_sorted с моделью на двух std::map: пачки с
+// повторами ключей внутри, с ключами, которые уже есть в bimap с любой
+// стороны, уже отсортированные и вставка в пустой bimap. Проверяются число
+// вставленных пар, порядок обхода и поиск с обеих сторон. Модель отбирает
+// пары так, как описано у insert_bulk: сначала по левым ключам (первая из
+// повторов, затем уже занятые), потом так же по правым в порядке пачки.
+// Сборка:
+//   g++ -std=c++17 -O1 -g -fsanitize=address,undefined test_bulk.cpp -o test_bulk && ./test_bulk
+#include "bimap.h"
+#include "bimap_pool.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include <map>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+namespace
+{
+  struct sum
+  {
+    using value_type = long long;
+
+    value_type identity() const { return 0; }
+    value_type lift(const int& left, const int& right) const { return left * 1000003LL + right; }
+    value_type combine(value_type a, value_type b) const { return a + b; }
+  };
+
+  using pair_alloc = std::allocator<std::pair<int, int>>;
+  using pool_alloc = bimap_pool_allocator<std::pair<int, int>>;
+  using int_hash = hashed_index<std::hash<int>>;
+
+  template <typename Left, typename Right, typename Alloc, typename Monoid>
+  struct config
+  {
+    using type = bimap<int, int, Left, Right, Alloc, Monoid>;
+    static constexpr bool left_ordered = !std::is_same_v<Left, int_hash>;
+    static constexpr bool right_ordered = !std::is_same_v<Right, int_hash>;
+    static constexpr bool has_monoid = !std::is_void_v<Monoid>;
+  };
+
+  using batch = std::vector<std::pair<int, int>>;
+
+  struct model
+  {
+    std::map<int, int> left;
+    std::map<int, int> right;
+
+    // Отбор insert_bulk: по левым ключам, затем по правым, каждый раз
+    // остается первая пара пачки, а занятые ключи отбрасываются
+    std::size_t insert_bulk(const batch& pairs)
+    {
+      std::set<int> seen_left, seen_right;
+      batch by_left;
+      for (const auto& p : pairs)
+      {
+        if (seen_left.insert(p.first).second && !left.count(p.first))
+          by_left.push_back(p);
+      }
+      std::size_t inserted = 0;
+      for (const auto& p : by_left)
+      {
+        if (seen_right.insert(p.second).second && !right.count(p.second))
+        {
+          left[p.first] = p.second;
+          right[p.second] = p.first;
+          inserted++;
+        }
+      }
+      return inserted;
+    }
+  };
+
+  template <typename Config>
+  void check(const typename Config::type& b, const model& m)
+  {
+    assert(b.size() == m.left.size());
+    for (const auto& p : m.left)
+    {
+      assert(b.at_left(p.first) == p.second);
+      assert(b.at_right(p.second) == p.first);
+    }
+
+    if constexpr (Config::left_ordered)
+    {
+      auto it = b.begin_left();
+      for (const auto& p : m.left)
+      {
+        assert(*it == p.first && *it.flip() == p.second);
+        ++it;
+      }
+      assert(it == b.end_left());
+      if (!m.left.empty())
+        assert(*b.nth_left(m.left.size() / 2) == std::next(m.left.begin(), m.left.size() / 2)->first);
+      if constexpr (Config::has_monoid)
+      {
+        long long total = 0;
+        for (const auto& p : m.left)
+          total += sum().lift(p.first, p.second);
+        assert(b.aggregate_left(0, std::numeric_limits<int>::max()) == total);
+      }
+    }
+    if constexpr (Config::right_ordered)
+    {
+      auto it = b.begin_right();
+      for (const auto& p : m.right)
+      {
+        assert(*it == p.first && *it.flip() == p.second);
+        ++it;
+      }
+      assert(it == b.end_right());
+    }
+  }
+
+  // Пачка из count пар с ключами в [0, key_range): при малом key_range в
+  // ней много повторов и совпадений с уже вставленными ключами
+  batch make_batch(std::mt19937& rng, std::size_t count, int key_range, bool sorted)
+  {
+    batch pairs(count);
+    for (auto& p : pairs)
+      p = {static_cast<int>(rng() % key_range), static_cast<int>(rng() % key_range)};
+    if (sorted)
+      std::stable_sort(pairs.begin(), pairs.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    return pairs;
+  }
+
+  template <typename Config>
+  void run(const char* name, unsigned seed)
+  {
+    using B = typename Config::type;
+    std::mt19937 rng(seed);
+    std::size_t batches = 0;
+    for (int round = 0; round < 40; round++)
+    {
+      const int key_range = 8 + round * 50;
+      B b;
+      model m;
+
+      // В пустой bimap
+      batch first = make_batch(rng, rng() % (key_range + 1), key_range, round % 2);
+      std::size_t inserted = b.insert_bulk(first.begin(), first.end());
+      assert(inserted == m.insert_bulk(first));
+      check<Config>(b, m);
+
+      for (int i = 0; i < 12; i++, batches++)
+      {
+        // Пачки от пустой до больше самого bimap, иногда уже отсортированные
+        std::size_t count = rng() % 4 == 0 ? 0 : rng() % (2 * b.size() + 8);
+        batch pairs = make_batch(rng, count, key_range, rng() % 3 == 0);
+        inserted = b.insert_bulk(pairs.begin(), pairs.end());
+        assert(inserted == m.insert_bulk(pairs));
+        check<Config>(b, m);
+
+        // Удаления освобождают ключи, и следующая пачка занимает их снова
+        for (int j = 0; j < 4 && !m.left.empty(); j++)
+        {
+          int l = std::next(m.left.begin(), rng() % m.left.size())->first;
+          bool erased = b.erase_left(l);
+          assert(erased);
+          m.right.erase(m.left[l]);
+          m.left.erase(l);
+        }
+      }
+      check<Config>(b, m);
+
+      // assign_sorted заменяет содержимое и отбирает пары так же, как пустой insert_bulk
+      batch sorted = make_batch(rng, rng() % (key_range + 1), key_range, true);
+      b.assign_sorted(sorted.begin(), sorted.end());
+      m = model();
+      m.insert_bulk(sorted);
+      check<Config>(b, m);
+      B copy;
+      copy.insert_bulk(sorted.begin(), sorted.end());
+      assert(copy == b);
+    }
+    std::printf("%-28s %zu batches ok\n", name, batches);
+  }
+}
+
+int main()
+{
+  run<config<std::less<int>, std::less<int>, pair_alloc, void>>("ordered", 1);
+  run<config<std::less<int>, std::less<int>, pair_alloc, sum>>("ordered, monoid", 2);
+  run<config<int_hash, std::less<int>, pair_alloc, void>>("hashed left", 3);
+  run<config<std::less<int>, int_hash, pool_alloc, sum>>("hashed right, pool, monoid", 4);
+}
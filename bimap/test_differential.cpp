@@ -0,0 +1,265 @@
+// Сверка bimap с парой std::map на случайных операциях: вставка, удаление
+// по ключу, удаление диапазона с каждой стороны, поиск, порядковые
+// статистики, свертка моноида, копирование и очистка. Проверяются обе
+// упорядоченные стороны, хеширование левой и правой стороны, пул и моноид.
+// Сборка:
+//   g++ -std=c++17 -O1 -g -fsanitize=address,undefined test_differential.cpp -o test_differential && ./test_differential
+#include "bimap.h"
+#include "bimap_pool.h"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace
+{
+  // Некоммутативная свертка: многочлен от правых значений в порядке ключей,
+  // поэтому неверный порядок сыновей при пересчете тоже будет замечен
+  struct poly_hash
+  {
+    using value_type = std::pair<std::uint64_t, std::uint64_t>;
+
+    value_type identity() const { return {0, 1}; }
+    value_type lift(const int&, const int& right) const { return {static_cast<std::uint64_t>(right) + 1, 31}; }
+    value_type combine(value_type a, value_type b) const { return {a.first * b.second + b.first, a.second * b.second}; }
+  };
+
+  using pair_alloc = std::allocator<std::pair<int, int>>;
+  using pool_alloc = bimap_pool_allocator<std::pair<int, int>>;
+  using int_hash = hashed_index<std::hash<int>>;
+
+  template <typename Left, typename Right, typename Alloc, typename Monoid>
+  struct config
+  {
+    using type = bimap<int, int, Left, Right, Alloc, Monoid>;
+    static constexpr bool left_ordered = !std::is_same_v<Left, int_hash>;
+    static constexpr bool right_ordered = !std::is_same_v<Right, int_hash>;
+    static constexpr bool has_monoid = !std::is_void_v<Monoid>;
+  };
+
+  struct model
+  {
+    std::map<int, int> left;
+    std::map<int, int> right;
+
+    void add(int l, int r)
+    {
+      left[l] = r;
+      right[r] = l;
+    }
+    void remove_left(int l)
+    {
+      right.erase(left[l]);
+      left.erase(l);
+    }
+  };
+
+  template <typename Map>
+  poly_hash::value_type fold(const Map& m, int from, int to, bool by_left)
+  {
+    poly_hash monoid;
+    poly_hash::value_type res = monoid.identity();
+    for (auto it = m.lower_bound(from); it != m.end() && it->first < to; ++it)
+      res = monoid.combine(res, monoid.lift(0, by_left ? it->second : it->first));
+    return res;
+  }
+
+  template <typename Config>
+  void check(const typename Config::type& b, const model& m, std::mt19937& rng, int key_range)
+  {
+    assert(b.size() == m.left.size());
+    for (const auto& p : m.left)
+    {
+      assert(b.at_left(p.first) == p.second);
+      assert(b.at_right(p.second) == p.first);
+    }
+
+    // Упорядоченная сторона идет по своим ключам, хешированная - в порядке другой
+    if constexpr (Config::left_ordered)
+    {
+      auto it = b.begin_left();
+      for (const auto& p : m.left)
+      {
+        assert(*it == p.first && *it.flip() == p.second);
+        ++it;
+      }
+      assert(it == b.end_left());
+    }
+    if constexpr (Config::right_ordered)
+    {
+      auto it = b.begin_right();
+      for (const auto& p : m.right)
+      {
+        assert(*it == p.first && *it.flip() == p.second);
+        ++it;
+      }
+      assert(it == b.end_right());
+    }
+    assert(static_cast<std::size_t>(std::distance(b.begin_left(), b.end_left())) == m.left.size());
+
+    for (int i = 0; i < 8; i++)
+    {
+      int from = static_cast<int>(rng() % key_range), to = from + static_cast<int>(rng() % (key_range / 4 + 1));
+      if constexpr (Config::left_ordered)
+      {
+        std::size_t rank = std::distance(m.left.begin(), m.left.lower_bound(from));
+        assert(b.rank_left(from) == rank);
+        assert(b.count_left(from, to) == static_cast<std::size_t>(std::distance(m.left.lower_bound(from),
+          m.left.lower_bound(to))));
+        if (rank < m.left.size())
+          assert(*b.nth_left(rank) == m.left.lower_bound(from)->first);
+        if constexpr (Config::has_monoid)
+          assert(b.aggregate_left(from, to) == fold(m.left, from, to, true));
+      }
+      if constexpr (Config::right_ordered)
+      {
+        std::size_t rank = std::distance(m.right.begin(), m.right.lower_bound(from));
+        assert(b.rank_right(from) == rank);
+        if (rank < m.right.size())
+          assert(*b.nth_right(rank) == m.right.lower_bound(from)->first);
+        if constexpr (Config::has_monoid)
+          assert(b.aggregate_right(from, to) == fold(m.right, from, to, false));
+      }
+    }
+  }
+
+  // Удаляет диапазон стороны is_left. У упорядоченной стороны это ключи из
+  // [from, to), у хешированной - несколько пар подряд в порядке другой стороны
+  template <typename Config, bool is_left>
+  void erase_range(typename Config::type& b, model& m, int from, int to, std::size_t steps)
+  {
+    constexpr bool ordered = is_left ? Config::left_ordered : Config::right_ordered;
+    auto side_begin = [&] { if constexpr (is_left) return b.begin_left(); else return b.begin_right(); };
+    auto side_end = [&] { if constexpr (is_left) return b.end_left(); else return b.end_right(); };
+
+    auto first = side_begin(), last = side_end();
+    if constexpr (ordered)
+    {
+      if constexpr (is_left)
+      {
+        first = b.lower_bound_left(from);
+        last = b.lower_bound_left(to);
+      }
+      else
+      {
+        first = b.lower_bound_right(from);
+        last = b.lower_bound_right(to);
+      }
+    }
+    else
+    {
+      std::advance(first, std::min<std::size_t>(steps, b.size()));
+      last = first;
+      for (std::size_t i = 0; i < steps && last != side_end(); i++)
+        ++last;
+    }
+
+    std::vector<int> gone;
+    for (auto it = first; it != last; ++it)
+    {
+      if constexpr (is_left)
+        gone.push_back(*it);
+      else
+        gone.push_back(*it.flip());
+    }
+    auto res = last;
+    if constexpr (is_left)
+      res = b.erase_left(first, last);
+    else
+      res = b.erase_right(first, last);
+    assert(res == last);
+    for (int l : gone)
+      m.remove_left(l);
+  }
+
+  template <typename Config>
+  void run(const char* name, unsigned seed)
+  {
+    using B = typename Config::type;
+    std::mt19937 rng(seed);
+    std::size_t ops = 0;
+    for (int round = 0; round < 12; round++)
+    {
+      const int key_range = 16 + round * 400;
+      B b;
+      model m;
+      for (int op = 0; op < 6000; op++, ops++)
+      {
+        int l = static_cast<int>(rng() % key_range), r = static_cast<int>(rng() % key_range);
+        switch (rng() % 10)
+        {
+        case 0: case 1: case 2: case 3:
+        {
+          bool fresh = !m.left.count(l) && !m.right.count(r);
+          bool inserted = b.insert(l, r) != b.end_left();
+          assert(inserted == fresh);
+          if (fresh)
+            m.add(l, r);
+          break;
+        }
+        case 4:
+        {
+          bool found = m.left.count(l);
+          bool erased = b.erase_left(l);
+          assert(erased == found);
+          if (found)
+            m.remove_left(l);
+          break;
+        }
+        case 5:
+        {
+          bool found = m.right.count(r);
+          bool erased = b.erase_right(r);
+          assert(erased == found);
+          if (found)
+            m.remove_left(m.right[r]);
+          break;
+        }
+        case 6:
+          erase_range<Config, true>(b, m, l, l + static_cast<int>(rng() % (key_range / 8 + 2)), rng() % 40);
+          break;
+        case 7:
+          erase_range<Config, false>(b, m, r, r + static_cast<int>(rng() % (key_range / 8 + 2)), rng() % 40);
+          break;
+        case 8:
+          assert((b.find_left(l) != b.end_left()) == (m.left.count(l) != 0));
+          assert((b.find_right(r) != b.end_right()) == (m.right.count(r) != 0));
+          break;
+        default:
+          erase_range<Config, true>(b, m, 0, key_range, rng() % 40);
+          break;
+        }
+        if (op % 250 == 0)
+          check<Config>(b, m, rng, key_range);
+      }
+      check<Config>(b, m, rng, key_range);
+
+      B copy(b);
+      assert(copy == b);
+      B assigned;
+      assigned = copy;
+      check<Config>(assigned, m, rng, key_range);
+      b.clear();
+      assert(b.empty() && b.begin_left() == b.end_left());
+      b = std::move(assigned);
+      check<Config>(b, m, rng, key_range);
+    }
+    std::printf("%-28s %zu ops ok\n", name, ops);
+  }
+}
+
+int main()
+{
+  run<config<std::less<int>, std::less<int>, pair_alloc, void>>("ordered", 1);
+  run<config<std::less<int>, std::less<int>, pair_alloc, poly_hash>>("ordered, monoid", 2);
+  run<config<int_hash, std::less<int>, pair_alloc, void>>("hashed left", 3);
+  run<config<std::less<int>, int_hash, pair_alloc, poly_hash>>("hashed right, monoid", 4);
+  run<config<std::less<int>, std::less<int>, pool_alloc, poly_hash>>("pool, monoid", 5);
+  run<config<int_hash, std::less<int>, pool_alloc, poly_hash>>("hashed left, pool, monoid", 6);
+}
@@ -0,0 +1,91 @@
+// Регрессионный тест bimap_pool: узлы крупнее последнего размерного класса
+// раньше не возвращались при clear() и деструкторе bimap, владеющего пулом.
+// Сборка с проверкой утечек:
+//   g++ -std=c++17 -O1 -g -fsanitize=address,undefined test_pool.cpp -o test_pool && ./test_pool
+#include "bimap.h"
+#include "bimap_pool.h"
+
+#include <array>
+#include <cassert>
+#include <cstdio>
+#include <functional>
+
+namespace
+{
+  // 300 байт: узел с такой парой не влезает ни в один размерный класс пула
+  struct wide
+  {
+    std::array<int, 75> data{};
+
+    explicit wide(int key = 0) { data.fill(key); }
+
+    friend bool operator<(const wide& a, const wide& b) { return a.data[0] < b.data[0]; }
+  };
+
+  using wide_bimap = bimap<int, wide, std::less<int>, std::less<wide>, bimap_pool_allocator<int>>;
+
+  void insert_range(wide_bimap& b, int from, int to)
+  {
+    for (int i = from; i < to; i++)
+      b.insert(i, wide(i));
+  }
+
+  void test_clear()
+  {
+    wide_bimap b;
+    insert_range(b, 0, 1000);
+    assert(b.size() == 1000);
+    b.clear();
+    assert(b.empty());
+
+    insert_range(b, 0, 500);
+    assert(b.size() == 500);
+    assert(b.at_right(wide(250)) == 250);
+  }
+
+  void test_erase_then_destroy()
+  {
+    wide_bimap b;
+    insert_range(b, 0, 1000);
+    for (int i = 0; i < 1000; i += 2)
+      assert(b.erase_left(i));
+    assert(b.size() == 500);
+    assert(b.find_left(1) != b.end_left());
+    assert(b.find_left(2) == b.end_left());
+  }
+
+  // Копия делит пул, поэтому clear() разбирает дерево по узлам
+  void test_shared_pool()
+  {
+    wide_bimap b;
+    insert_range(b, 0, 1000);
+    wide_bimap c(b);
+    c = b;
+    b.clear();
+    assert(c.size() == 1000);
+  }
+
+  void test_pool_directly()
+  {
+    bimap_pool pool;
+    void* small = pool.allocate(64);
+    void* large[3];
+    for (void*& block : large)
+      block = pool.allocate(1000);
+    pool.deallocate(large[1], 1000);
+    pool.deallocate(large[0], 1000);
+    pool.deallocate(small, 64);
+    large[0] = pool.allocate(4000);
+    pool.release();
+    pool.allocate(2000);
+  }
+}
+
+int main()
+{
+  test_clear();
+  test_erase_then_destroy();
+  test_shared_pool();
+  test_pool_directly();
+  std::puts("ok");
+}
@@ -0,0 +1,212 @@
+// Разнородный поиск: bimap<std::string, std::string, std::less<>, std::less<>>
+// ищет и удаляет по std::string_view и const char* с обеих сторон, результаты
+// сверяются с std::map. Во время компиляции проверяется, что без прозрачного
+// компаратора string_view ключом не принимается: std::string из него неявно
+// не строится, а разнородных перегрузок у такой стороны нет.
+// Сборка:
+//   g++ -std=c++17 -O1 -g -fsanitize=address,undefined test_transparent.cpp -o test_transparent && ./test_transparent
+#include "bimap.h"
+
+#include <cassert>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace
+{
+  using open_map = bimap<std::string, std::string, std::less<>, std::less<>>;
+  using plain_map = bimap<std::string, std::string>;
+
+  // Определители: компилируется ли вызов с ключом типа K
+  template <typename B, typename K, typename = void>
+  struct finds_left : std::false_type {};
+  template <typename B, typename K>
+  struct finds_left<B, K, std::void_t<decltype(std::declval<const B&>().find_left(std::declval<K>()))>>
+    : std::true_type {};
+
+  template <typename B, typename K, typename = void>
+  struct finds_right : std::false_type {};
+  template <typename B, typename K>
+  struct finds_right<B, K, std::void_t<decltype(std::declval<const B&>().find_right(std::declval<K>()))>>
+    : std::true_type {};
+
+  template <typename B, typename K, typename = void>
+  struct reads_left : std::false_type {};
+  template <typename B, typename K>
+  struct reads_left<B, K, std::void_t<decltype(std::declval<const B&>().at_left(std::declval<K>()))>>
+    : std::true_type {};
+
+  template <typename B, typename K, typename = void>
+  struct bounds_right : std::false_type {};
+  template <typename B, typename K>
+  struct bounds_right<B, K, std::void_t<decltype(std::declval<const B&>().lower_bound_right(std::declval<K>()))>>
+    : std::true_type {};
+
+  template <typename B, typename K, typename = void>
+  struct erases_left : std::false_type {};
+  template <typename B, typename K>
+  struct erases_left<B, K, std::void_t<decltype(std::declval<B&>().erase_left(std::declval<K>()))>>
+    : std::true_type {};
+
+  template <typename B, typename K, typename = void>
+  struct erases_right : std::false_type {};
+  template <typename B, typename K>
+  struct erases_right<B, K, std::void_t<decltype(std::declval<B&>().erase_right(std::declval<K>()))>>
+    : std::true_type {};
+
+  static_assert(finds_left<open_map, std::string_view>::value && finds_right<open_map, std::string_view>::value);
+  static_assert(reads_left<open_map, std::string_view>::value && bounds_right<open_map, std::string_view>::value);
+  static_assert(erases_left<open_map, std::string_view>::value && erases_right<open_map, std::string_view>::value);
+
+  static_assert(!finds_left<plain_map, std::string_view>::value && !finds_right<plain_map, std::string_view>::value);
+  static_assert(!reads_left<plain_map, std::string_view>::value && !bounds_right<plain_map, std::string_view>::value);
+  static_assert(!erases_left<plain_map, std::string_view>::value && !erases_right<plain_map, std::string_view>::value);
+
+  // const char* по-прежнему доходит до обычных перегрузок через std::string
+  static_assert(finds_left<plain_map, const char*>::value && erases_right<plain_map, const char*>::value);
+
+  bool throws_left(const open_map& b, std::string_view key)
+  {
+    try
+    {
+      b.at_left(key);
+    }
+    catch (const std::out_of_range&)
+    {
+      return true;
+    }
+    return false;
+  }
+
+  bool throws_right(const open_map& b, const char* key)
+  {
+    try
+    {
+      b.at_right(key);
+    }
+    catch (const std::out_of_range&)
+    {
+      return true;
+    }
+    return false;
+  }
+
+  template <typename It, typename Map>
+  bool same_bound(It it, It end, const Map& m, typename Map::const_iterator expected)
+  {
+    return expected == m.end() ? it == end : it != end && *it == expected->first;
+  }
+
+  void check(const open_map& b, const std::map<std::string, std::string, std::less<>>& left,
+             const std::map<std::string, std::string, std::less<>>& right, const std::vector<std::string>& keys)
+  {
+    assert(b.size() == left.size());
+    for (const std::string& key : keys)
+    {
+      std::string_view view = key;
+      const char* str = key.c_str();
+
+      auto l = left.find(view);
+      assert((b.find_left(view) == b.end_left()) == (l == left.end()));
+      assert((b.find_left(str) == b.end_left()) == (l == left.end()));
+      assert(throws_left(b, view) == (l == left.end()));
+      if (l != left.end())
+      {
+        assert(b.at_left(view) == l->second && b.at_left(str) == l->second);
+        assert(*b.find_left(str).flip() == l->second);
+      }
+
+      auto r = right.find(str);
+      assert((b.find_right(view) == b.end_right()) == (r == right.end()));
+      assert((b.find_right(str) == b.end_right()) == (r == right.end()));
+      assert(throws_right(b, str) == (r == right.end()));
+      if (r != right.end())
+        assert(b.at_right(view) == r->second && *b.find_right(view).flip() == r->second);
+
+      assert(same_bound(b.lower_bound_left(view), b.end_left(), left, left.lower_bound(view)));
+      assert(same_bound(b.upper_bound_left(str), b.end_left(), left, left.upper_bound(str)));
+      assert(same_bound(b.lower_bound_right(str), b.end_right(), right, right.lower_bound(str)));
+      assert(same_bound(b.upper_bound_right(view), b.end_right(), right, right.upper_bound(view)));
+    }
+  }
+}
+
+int main()
+{
+  std::mt19937 rng(1);
+  std::vector<std::string> keys;
+  for (int i = 0; i < 300; i++)
+    keys.push_back("key" + std::to_string(rng() % 1000));
+
+  std::size_t ops = 0;
+  for (int round = 0; round < 20; round++)
+  {
+    open_map b;
+    std::map<std::string, std::string, std::less<>> left, right;
+    for (int op = 0; op < 2000; op++, ops++)
+    {
+      const std::string& l = keys[rng() % keys.size()];
+      const std::string& r = keys[rng() % keys.size()];
+      switch (rng() % 5)
+      {
+      case 0: case 1:
+        if (!left.count(l) && !right.count(r))
+        {
+          b.insert(l, r);
+          left[l] = r;
+          right[r] = l;
+        }
+        break;
+      case 2:
+      {
+        // Удаление по string_view слева
+        bool found = left.count(l);
+        bool erased = b.erase_left(std::string_view(l));
+        assert(erased == found);
+        if (found)
+        {
+          right.erase(left.find(l)->second);
+          left.erase(l);
+        }
+        break;
+      }
+      case 3:
+      {
+        // и по const char* справа
+        bool found = right.count(r);
+        bool erased = b.erase_right(r.c_str());
+        assert(erased == found);
+        if (found)
+        {
+          left.erase(right.find(r)->second);
+          right.erase(r);
+        }
+        break;
+      }
+      default:
+      {
+        bool found = right.count(l);
+        bool erased = b.erase_right(std::string_view(l));
+        assert(erased == found);
+        if (found)
+        {
+          left.erase(right.find(l)->second);
+          right.erase(l);
+        }
+        break;
+      }
+      }
+      if (op % 250 == 0)
+        check(b, left, right, keys);
+    }
+    check(b, left, right, keys);
+  }
+  std::printf("%-28s %zu ops ok\n", "string_view, const char*", ops);
+}
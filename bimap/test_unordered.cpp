@@ -0,0 +1,251 @@
+// Сверка unordered_bimap с парой std::map на случайных операциях: вставка,
+// удаление по ключу и по итератору (на место удаленной пары переезжает
+// последняя, и ее слоты в обеих таблицах перенаправляются), поиск, промахи
+// at_left и at_right, копирование и очистка. Отдельно проверяется, что при
+// постоянном размере удаленные слоты выбрасываются перестроением таблиц, и
+// хеш с множеством совпадений, при котором пробы идут через много групп.
+// Вторая команда собирает тот же тест без SSE2, на обычном цикле по группе.
+// Сборка:
+//   g++ -std=c++17 -O1 -g -fsanitize=address,undefined test_unordered.cpp -o test_unordered && ./test_unordered
+//   g++ -std=c++17 -O1 -g -fsanitize=address,undefined -U__SSE2__ test_unordered.cpp -o test_unordered && ./test_unordered
+#include "unordered_bimap.h"
+
+#include <cassert>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+  // Считает вызовы, чтобы видеть перестроения таблиц. При collide ключи
+  // сводятся к восьми хешам, и цепочки проб проходят через много групп
+  struct counting_hash
+  {
+    static std::size_t calls;
+    bool collide = false;
+
+    std::size_t operator()(int key) const
+    {
+      calls++;
+      return collide ? static_cast<std::size_t>(key & 7) : std::hash<int>()(key);
+    }
+  };
+  std::size_t counting_hash::calls = 0;
+
+  using map_t = unordered_bimap<int, int, counting_hash, counting_hash>;
+
+  struct model
+  {
+    std::map<int, int> left;
+    std::map<int, int> right;
+
+    void add(int l, int r)
+    {
+      left[l] = r;
+      right[r] = l;
+    }
+    void remove_left(int l)
+    {
+      right.erase(left[l]);
+      left.erase(l);
+    }
+  };
+
+  bool throws_left(const map_t& b, int key)
+  {
+    try
+    {
+      b.at_left(key);
+    }
+    catch (const std::out_of_range&)
+    {
+      return true;
+    }
+    return false;
+  }
+
+  bool throws_right(const map_t& b, int key)
+  {
+    try
+    {
+      b.at_right(key);
+    }
+    catch (const std::out_of_range&)
+    {
+      return true;
+    }
+    return false;
+  }
+
+  void check(const map_t& b, const model& m, int key_range)
+  {
+    assert(b.size() == m.left.size());
+    assert(b.empty() == m.left.empty());
+    for (const auto& p : m.left)
+    {
+      assert(b.at_left(p.first) == p.second);
+      assert(b.at_right(p.second) == p.first);
+      assert(*b.find_left(p.first).flip() == p.second);
+      assert(*b.find_right(p.second).flip() == p.first);
+    }
+
+    // Каждая пара встречается при обходе ровно один раз
+    std::size_t seen = 0;
+    for (auto it = b.begin_left(); it != b.end_left(); ++it, seen++)
+      assert(m.left.count(*it) && m.left.at(*it) == *it.flip());
+    assert(seen == m.left.size());
+
+    for (int key = -1; key <= key_range; key++)
+    {
+      assert((b.find_left(key) == b.end_left()) == !m.left.count(key));
+      assert((b.find_right(key) == b.end_right()) == !m.right.count(key));
+      assert(throws_left(b, key) == !m.left.count(key));
+      assert(throws_right(b, key) == !m.right.count(key));
+    }
+  }
+
+  void run(const char* name, bool collide, unsigned seed)
+  {
+    std::mt19937 rng(seed);
+    std::size_t ops = 0;
+    for (int round = 0; round < 8; round++)
+    {
+      const int key_range = 8 + round * (collide ? 40 : 300);
+      counting_hash hash;
+      hash.collide = collide;
+      map_t b(hash, hash);
+      model m;
+      for (int op = 0; op < 4000; op++, ops++)
+      {
+        int l = static_cast<int>(rng() % key_range), r = static_cast<int>(rng() % key_range);
+        switch (rng() % 8)
+        {
+        case 0: case 1: case 2:
+        {
+          bool fresh = !m.left.count(l) && !m.right.count(r);
+          // Вставка сдвигает end_left, поэтому он берется после нее
+          auto it = b.insert(l, r);
+          bool inserted = it != b.end_left();
+          assert(inserted == fresh);
+          if (fresh)
+            m.add(l, r);
+          break;
+        }
+        case 3:
+        {
+          bool found = m.left.count(l);
+          bool erased = b.erase_left(l);
+          assert(erased == found);
+          if (found)
+            m.remove_left(l);
+          break;
+        }
+        case 4:
+        {
+          bool found = m.right.count(r);
+          bool erased = b.erase_right(r);
+          assert(erased == found);
+          if (found)
+            m.remove_left(m.right[r]);
+          break;
+        }
+        case 5:
+        {
+          // Удаление по итератору из середины: на его место встает последняя пара
+          if (b.empty())
+            break;
+          auto it = b.begin_left();
+          std::advance(it, rng() % b.size());
+          const int gone = *it;
+          const bool was_last = std::next(it) == b.end_left();
+          const int last = *std::prev(b.end_left());
+          it = b.erase_left(it);
+          m.remove_left(gone);
+          if (was_last)
+            assert(it == b.end_left());
+          else
+            assert(*it == last && b.find_left(last) == it);
+          break;
+        }
+        case 6:
+        {
+          if (b.empty())
+            break;
+          auto it = b.begin_right();
+          std::advance(it, rng() % b.size());
+          const int gone = *it.flip();
+          b.erase_right(it);
+          m.remove_left(gone);
+          break;
+        }
+        default:
+          assert((b.find_left(l) != b.end_left()) == (m.left.count(l) != 0));
+          assert((b.find_right(r) != b.end_right()) == (m.right.count(r) != 0));
+          break;
+        }
+        if (op % 200 == 0)
+          check(b, m, key_range);
+      }
+      check(b, m, key_range);
+
+      map_t copy(b);
+      assert(copy == b);
+      check(copy, m, key_range);
+      b.clear();
+      assert(b.empty() && b.begin_left() == b.end_left() && throws_left(b, 0));
+      assert(copy != b);
+      b = copy;
+      check(b, m, key_range);
+    }
+    std::printf("%-28s %zu ops ok\n", name, ops);
+  }
+
+  // При постоянном размере каждое удаление оставляет удаленный слот, и без
+  // перестроения таблицы постепенно остались бы без пустых слотов. Перестроение
+  // видно по всплеску вызовов хеша: оно заново раскладывает все пары
+  void run_churn()
+  {
+    const int size = 1000, churn = 200000;
+    map_t b;
+    model m;
+    for (int i = 0; i < size; i++)
+    {
+      b.insert(i, -i);
+      m.add(i, -i);
+    }
+
+    int rehashes = 0;
+    for (int i = 0; i < churn; i++)
+    {
+      std::size_t calls = counting_hash::calls;
+      const int gone = i, fresh = size + i;
+      bool erased = b.erase_left(gone);
+      assert(erased);
+      m.remove_left(gone);
+      auto it = b.insert(fresh, -fresh);
+      assert(it != b.end_left());
+      m.add(fresh, -fresh);
+      if (counting_hash::calls - calls >= 2 * static_cast<std::size_t>(size))
+        rehashes++;
+    }
+    check(b, m, size + churn);
+    // Перестроений хватает, чтобы выбросить удаленные слоты, но они не идут
+    // на каждой операции
+    assert(rehashes > 0 && rehashes < churn / 100);
+    std::printf("%-28s %d ops, %d rehashes ok\n", "tombstone purge", churn, rehashes);
+  }
+}
+
+int main()
+{
+#ifdef __SSE2__
+  std::printf("SSE2 group probing\n");
+#else
+  std::printf("scalar group probing\n");
+#endif
+  run("random", false, 1);
+  run("colliding hashes", true, 2);
+  run_churn();
+}
@@ -0,0 +1,433 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "hash_group.h"
+
+// Неупорядоченный bimap: пары лежат один раз подряд в массиве, а каждая
+// сторона индексируется своей хеш-таблицей с открытой адресацией. Таблица
+// разбита на группы по 16 управляющих байт (7 бит хеша или метка пустого и
+// удаленного слота), группа проверяется целиком одной SIMD-командой, а в
+// слоте лежит 32-битный номер пары в массиве. Поиск обычно читает одну
+// группу управляющих байт, один слот и саму пару.
+// Удаление переносит на место удаленной пары последнюю, поэтому оно
+// инвалидирует итераторы на последнюю пару, а вставка - все итераторы.
+template <typename Left, typename Right, typename HashLeft = std::hash<Left>,
+  typename HashRight = std::hash<Right>, typename EqualLeft = std::equal_to<Left>,
+  typename EqualRight = std::equal_to<Right>>
+  class unordered_bimap
+{
+  using entry_t = std::pair<Left, Right>;
+
+  // Индекс одной стороны: управляющие байты и номера пар
+  struct side_index
+  {
+    std::vector<std::int8_t> ctrl;
+    std::vector<std::uint32_t> slots;
+  };
+
+public:
+  using left_t = Left;
+  using right_t = Right;
+
+  template <bool is_left>
+  struct iterator
+  {
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = std::conditional_t<is_left, Left, Right>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const value_type*;
+    using reference = const value_type&;
+    using iter = iterator<is_left>;
+    friend unordered_bimap;
+
+    iterator(const entry_t* ptr) : ptr(ptr) {}
+
+    reference operator*() const
+    {
+      if constexpr (is_left)
+        return ptr->first;
+      else
+        return ptr->second;
+    }
+
+    iter& operator++()
+    {
+      ++ptr;
+      return *this;
+    }
+    iter operator++(int)
+    {
+      iter copy = *this;
+      ++(*this);
+      return copy;
+    }
+
+    iter& operator--()
+    {
+      --ptr;
+      return *this;
+    }
+    iter operator--(int)
+    {
+      iter copy = *this;
+      --(*this);
+      return copy;
+    }
+
+    iterator<!is_left> flip() const { return iterator<!is_left>(ptr); }
+
+    friend bool operator==(const iter& first, const iter& second)
+    {
+      return first.ptr == second.ptr;
+    }
+
+    friend bool operator!=(const iter& first, const iter& second)
+    {
+      return !(first == second);
+    }
+
+  private:
+    const entry_t* ptr;
+  };
+
+  using left_iterator = iterator<true>;
+  using right_iterator = iterator<false>;
+
+  // Создает unordered_bimap не содержащий ни одной пары.
+  unordered_bimap(HashLeft hash_left = HashLeft(), HashRight hash_right = HashRight(),
+    EqualLeft equal_left = EqualLeft(), EqualRight equal_right = EqualRight())
+    : hash_left(hash_left)
+    , hash_right(hash_right)
+    , equal_left(equal_left)
+    , equal_right(equal_right)
+    , group_count(0)
+    , deleted_cnt(0)
+  {}
+
+  // Вставка пары (left, right), возвращает итератор на left.
+  // Если такой left или такой right уже присутствуют, вставка не
+  // производится и возвращается end_left().
+  left_iterator insert(left_t const& left, right_t const& right)
+  {
+    return emplace(left, right);
+  }
+  left_iterator insert(left_t const& left, right_t&& right)
+  {
+    return emplace(left, std::move(right));
+  }
+  left_iterator insert(left_t&& left, right_t const& right)
+  {
+    return emplace(std::move(left), right);
+  }
+  left_iterator insert(left_t&& left, right_t&& right)
+  {
+    return emplace(std::move(left), std::move(right));
+  }
+
+  // Удаляет пару, на которую указывает итератор, и возвращает итератор на
+  // то же место: туда переезжает последняя пара
+  left_iterator erase_left(left_iterator it)
+  {
+    if (it == end_left()) { return it; }
+
+    erase_at(static_cast<std::size_t>(it.ptr - entries.data()));
+    return it;
+  }
+  right_iterator erase_right(right_iterator it)
+  {
+    return erase_left(it.flip()).flip();
+  }
+
+  // Аналогично erase, но по ключу, возвращает была ли пара удалена
+  bool erase_left(left_t const& left) { return erase<true>(left); }
+  bool erase_right(right_t const& right) { return erase<false>(right); }
+
+  // Возвращает итератор по элементу. Если не найден - соответствующий end()
+  left_iterator find_left(left_t const& left) const
+  {
+    std::size_t index = find_entry<true>(left);
+    return index == NOT_FOUND ? end_left() : left_iterator(entries.data() + index);
+  }
+  right_iterator find_right(right_t const& right) const
+  {
+    std::size_t index = find_entry<false>(right);
+    return index == NOT_FOUND ? end_right() : right_iterator(entries.data() + index);
+  }
+
+  // Возвращает противоположный элемент по элементу
+  // Если элемента не существует -- бросает std::out_of_range
+  right_t const& at_left(left_t const& key) const { return at<true>(key); }
+  left_t const& at_right(right_t const& key) const { return at<false>(key); }
+
+  // Как в bimap: если элемента нет, добавляет его в пару к дефолтному,
+  // предварительно удалив пару, в которой дефолтный элемент уже лежит
+  template <class = typename std::enable_if<std::is_default_constructible_v<right_t>>>
+  right_t const& at_left_or_default(left_t const& key)
+  {
+    std::size_t index = find_entry<true>(key);
+    if (index == NOT_FOUND)
+    {
+      erase_right(right_t());
+      index = static_cast<std::size_t>(insert(key, right_t()).ptr - entries.data());
+    }
+    return entries[index].second;
+  }
+  template <class = typename std::enable_if<std::is_default_constructible_v<left_t>>>
+  left_t const& at_right_or_default(right_t const& key)
+  {
+    std::size_t index = find_entry<false>(key);
+    if (index == NOT_FOUND)
+    {
+      erase_left(left_t());
+      index = static_cast<std::size_t>(insert(left_t(), key).ptr - entries.data());
+    }
+    return entries[index].first;
+  }
+
+  // Пары обходятся в порядке массива, одинаковом для обеих сторон
+  left_iterator begin_left() const { return left_iterator(entries.data()); }
+  left_iterator end_left() const { return left_iterator(entries.data() + entries.size()); }
+  right_iterator begin_right() const { return right_iterator(entries.data()); }
+  right_iterator end_right() const { return right_iterator(entries.data() + entries.size()); }
+
+  // Готовит таблицы к count парам без перестроения по дороге
+  void reserve(std::size_t count)
+  {
+    entries.reserve(count);
+    if (count > hash_group::capacity_limit(group_count))
+      rehash(hash_group::groups_for(count));
+  }
+
+  void clear()
+  {
+    entries.clear();
+    left_index = side_index();
+    right_index = side_index();
+    group_count = 0;
+    deleted_cnt = 0;
+  }
+
+  // Проверка на пустоту
+  bool empty() const { return entries.empty(); }
+
+  // Возвращает размер (кол-во пар)
+  std::size_t size() const { return entries.size(); }
+
+  // Равны, если состоят из одних и тех же пар, порядок не важен
+  friend bool operator==(unordered_bimap const& a, unordered_bimap const& b)
+  {
+    if (a.size() != b.size())
+      return false;
+    for (const entry_t& entry : a.entries)
+    {
+      std::size_t index = b.template find_entry<true>(entry.first);
+      if (index == NOT_FOUND || !b.equal_right(b.entries[index].second, entry.second))
+        return false;
+    }
+    return true;
+  }
+  friend bool operator!=(unordered_bimap const& a, unordered_bimap const& b) { return !(a == b); }
+
+private:
+  static constexpr std::size_t NOT_FOUND = static_cast<std::size_t>(-1);
+
+  std::vector<entry_t> entries;
+  side_index left_index;
+  side_index right_index;
+  HashLeft hash_left;
+  HashRight hash_right;
+  EqualLeft equal_left;
+  EqualRight equal_right;
+  std::size_t group_count;
+  std::size_t deleted_cnt;
+
+  template <bool is_left>
+  using val_type = std::conditional_t<is_left, left_t, right_t>;
+
+  template <bool is_left>
+  static const val_type<is_left>& key_of(const entry_t& entry)
+  {
+    if constexpr (is_left)
+      return entry.first;
+    else
+      return entry.second;
+  }
+
+  template <bool is_left>
+  side_index& index_of()
+  {
+    if constexpr (is_left)
+      return left_index;
+    else
+      return right_index;
+  }
+  template <bool is_left>
+  const side_index& index_of() const
+  {
+    if constexpr (is_left)
+      return left_index;
+    else
+      return right_index;
+  }
+
+  template <bool is_left>
+  std::size_t hash_of(const val_type<is_left>& key) const
+  {
+    if constexpr (is_left)
+      return hash_group::mix(static_cast<std::uint64_t>(hash_left(key)));
+    else
+      return hash_group::mix(static_cast<std::uint64_t>(hash_right(key)));
+  }
+
+  template <bool is_left>
+  bool equal(const val_type<is_left>& a, const val_type<is_left>& b) const
+  {
+    if constexpr (is_left)
+      return equal_left(a, b);
+    else
+      return equal_right(a, b);
+  }
+
+  template <bool is_left>
+  std::size_t find_entry(const val_type<is_left>& key) const
+  {
+    if (group_count == 0)
+      return NOT_FOUND;
+
+    const side_index& index = index_of<is_left>();
+    std::size_t hash = hash_of<is_left>(key);
+    std::int8_t byte = hash_group::control_byte(hash);
+    std::size_t group = (hash >> 7) & (group_count - 1);
+    for (std::size_t step = 1; step <= group_count; step++)
+    {
+      const std::int8_t* ctrl = index.ctrl.data() + group * hash_group::SIZE;
+      for (std::uint32_t candidates = hash_group::match(ctrl, byte); candidates; candidates &= candidates - 1)
+      {
+        std::uint32_t entry = index.slots[group * hash_group::SIZE + hash_group::lowest_bit(candidates)];
+        if (equal<is_left>(key_of<is_left>(entries[entry]), key))
+          return entry;
+      }
+      if (hash_group::match(ctrl, hash_group::EMPTY))
+        return NOT_FOUND;
+      group = (group + step) & (group_count - 1);
+    }
+    return NOT_FOUND;
+  }
+
+  // Слот, в котором лежит номер entry; пара с этим номером обязана быть в таблице
+  template <bool is_left>
+  std::size_t find_slot(std::size_t entry) const
+  {
+    const side_index& index = index_of<is_left>();
+    std::size_t hash = hash_of<is_left>(key_of<is_left>(entries[entry]));
+    std::int8_t byte = hash_group::control_byte(hash);
+    std::size_t group = (hash >> 7) & (group_count - 1);
+    for (std::size_t step = 1;; step++)
+    {
+      const std::int8_t* ctrl = index.ctrl.data() + group * hash_group::SIZE;
+      for (std::uint32_t candidates = hash_group::match(ctrl, byte); candidates; candidates &= candidates - 1)
+      {
+        std::size_t slot = group * hash_group::SIZE + hash_group::lowest_bit(candidates);
+        if (index.slots[slot] == entry)
+          return slot;
+      }
+      group = (group + step) & (group_count - 1);
+    }
+  }
+
+  // Кладет номер entry в первый свободный слот на пути его хеша
+  template <bool is_left>
+  void place(std::size_t entry)
+  {
+    side_index& index = index_of<is_left>();
+    std::size_t hash = hash_of<is_left>(key_of<is_left>(entries[entry]));
+    std::size_t group = (hash >> 7) & (group_count - 1);
+    for (std::size_t step = 1;; step++)
+    {
+      std::uint32_t free = hash_group::match_free(index.ctrl.data() + group * hash_group::SIZE);
+      if (free)
+      {
+        std::size_t slot = group * hash_group::SIZE + hash_group::lowest_bit(free);
+        index.ctrl[slot] = hash_group::control_byte(hash);
+        index.slots[slot] = static_cast<std::uint32_t>(entry);
+        return;
+      }
+      group = (group + step) & (group_count - 1);
+    }
+  }
+
+  // Перестраивает обе таблицы заново, заодно выбрасывая удаленные слоты
+  void rehash(std::size_t groups)
+  {
+    group_count = groups;
+    deleted_cnt = 0;
+    for (side_index* index : { &left_index, &right_index })
+    {
+      index->ctrl.assign(groups * hash_group::SIZE, hash_group::EMPTY);
+      index->slots.assign(groups * hash_group::SIZE, 0);
+    }
+    for (std::size_t i = 0; i < entries.size(); i++)
+    {
+      place<true>(i);
+      place<false>(i);
+    }
+  }
+
+  template <class L, class R>
+  left_iterator emplace(L&& left, R&& right)
+  {
+    if (find_entry<true>(left) != NOT_FOUND || find_entry<false>(right) != NOT_FOUND)
+      return end_left();
+
+    if (entries.size() + 1 + deleted_cnt > hash_group::capacity_limit(group_count))
+      rehash(hash_group::groups_for(entries.size() + 1));
+    entries.emplace_back(std::forward<L>(left), std::forward<R>(right));
+    place<true>(entries.size() - 1);
+    place<false>(entries.size() - 1);
+    return left_iterator(entries.data() + entries.size() - 1);
+  }
+
+  void erase_at(std::size_t entry)
+  {
+    std::size_t last = entries.size() - 1;
+    left_index.ctrl[find_slot<true>(entry)] = hash_group::DELETED;
+    right_index.ctrl[find_slot<false>(entry)] = hash_group::DELETED;
+    deleted_cnt++;
+    if (entry != last)
+    {
+      left_index.slots[find_slot<true>(last)] = static_cast<std::uint32_t>(entry);
+      right_index.slots[find_slot<false>(last)] = static_cast<std::uint32_t>(entry);
+      entries[entry] = std::move(entries[last]);
+    }
+    entries.pop_back();
+  }
+
+  template <bool is_left>
+  const val_type<!is_left>& at(const val_type<is_left>& key) const
+  {
+    std::size_t index = find_entry<is_left>(key);
+    if (index == NOT_FOUND)
+    {
+      throw std::out_of_range("element with given key doesn't exist");
+    }
+    return key_of<!is_left>(entries[index]);
+  }
+
+  template <bool is_left>
+  bool erase(const val_type<is_left>& key)
+  {
+    std::size_t index = find_entry<is_left>(key);
+    if (index == NOT_FOUND)
+      return false;
+    erase_at(index);
+    return true;
+  }
+};